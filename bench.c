@@ -0,0 +1,101 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+
+/* Run a benchmark at least this long, in usec */
+#define BENCH_TIME	(G_USEC_PER_SEC / 4)
+
+/*
+ * Count the allocations by taking over the allocator entry points of
+ * glibc, glib allocates through them as well.  Not exact with more than
+ * one thread, the benchmarks run in one.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static gsize allocs;
+
+void *
+malloc(size_t size)
+{
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void
+bench_init(void)
+{
+    /* older glib has its own slab allocator for lists, count those too */
+    g_setenv("G_SLICE", "always-malloc", TRUE);
+    printf("# %-44s %12s %12s\n", "benchmark", "ns/op", "allocs/op");
+}
+
+void
+bench_run(const gchar *name, BenchFunc func, gpointer data)
+{
+    gint64 start, elapsed;
+    gsize count;
+    glong n, i;
+
+    /* warm up, then double the calls until it takes long enough */
+    func(data);
+    for (n = 1; ; n *= 2) {
+	count = allocs;
+	start = g_get_monotonic_time();
+	for (i = 0; i < n; i++)
+	    func(data);
+	elapsed = g_get_monotonic_time() - start;
+	if (elapsed >= BENCH_TIME)
+	    break;
+    }
+    printf("  %-44s %12.1f %12.2f\n", name, elapsed * 1000.0 / n,
+	   (gdouble)(allocs - count) / n);
+    fflush(stdout);
+}
@@ -0,0 +1,48 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+
+
+#include <glib.h>
+
+
+/*
+ * A small harness for the microbenchmarks (make bench).  Each benchmark
+ * is a function run over and over until the time is long enough to
+ * measure, and reported in ns and allocations (malloc, calloc, realloc,
+ * i.e. g_malloc and friends too) per call.
+ */
+
+typedef void (*BenchFunc)(gpointer data);
+
+extern	void bench_init(void);
+extern	void bench_run(const gchar *name, BenchFunc func, gpointer data);
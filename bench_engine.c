@@ -0,0 +1,148 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+/*
+ * Microbenchmarks of the engine's per-sample path: a response coming in
+ * through snmp_input(), its varbinds decoded, the round finished and the
+ * result handed over through the ring.  The engine is built right into
+ * this file to get at its static functions, no agent or socket needed.
+ */
+
+#include "simpleSNMP.c"
+#include "bench.h"
+
+
+typedef struct {
+	simple_session		*ss;
+	struct snmp_pdu		*pdu;		/* the response */
+} InputBench;
+
+static oid bench_oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, 1 };
+
+static void
+bench_input(gpointer data)
+{
+    InputBench *b = data;
+    simple_session *ss = b->ss;
+    struct variable_list *vars;
+    snmp_request *request;
+    snmp_round *round;
+    snmp_result result;
+    gint i = 0;
+
+    /* what shard_send() and send_request() leave for the response */
+    round = g_new0(snmp_round, 1);
+    round->result.ss = ss;
+    round->pending = 1;
+    ss->rounds = g_slist_append(ss->rounds, round);
+    ss->num_rounds++;
+    request = g_new0(snmp_request, 1);
+    request->ss = ss;
+    request->agent = ss->agent;
+    request->round = round;
+    for (vars = b->pdu->variables; vars; vars = vars->next_variable, i++)
+	request->var[request->num_var++] =
+		snmp_oid_compare(vars->name, vars->name_length, sysUpTime,
+				 OID_LENGTH(sysUpTime)) ? i : VAR_UPTIME;
+    request->sent = clock_now();
+    ss->requests = g_slist_prepend(ss->requests, request);
+
+    snmp_input(RECEIVED_MESSAGE, &ss->template, 0, b->pdu, request);
+
+    /* the GTK thread's part, see simpleSNMPupdate() */
+    while (ring_pop(&ss->shard->results, &result))
+	free_result(&result);
+}
+
+static simple_session *
+bench_session(gint num_oid)
+{
+    simple_session *ss;
+
+    ss = g_new0(simple_session, 1);
+    ss->shard = g_new0(snmp_shard, 1);
+    ss->agent = g_new0(snmp_agent, 1);
+    ss->agent->uptime = -1;
+    ss->heap_index = -1;
+    ss->num_oid = num_oid;
+    return ss;
+}
+
+static void
+input(const gchar *name, gint type, gconstpointer value, gsize len)
+{
+    InputBench b;
+
+    b.ss = bench_session(1);
+    b.pdu = snmp_pdu_create(SNMP_MSG_RESPONSE);
+    snmp_pdu_add_variable(b.pdu, bench_oid, OID_LENGTH(bench_oid),
+			  type, (u_char *)value, len);
+    bench_run(name, bench_input, &b);
+    snmp_free_pdu(b.pdu);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct counter64 c64 = { 0x12, 0x34567890 };
+    u_long counter = 4000000000UL;
+    u_long ticks = 123456789;
+    long integer = -42;
+    InputBench b;
+    gint i;
+
+    bench_init();
+
+    input("snmp_input INTEGER", ASN_INTEGER, &integer, sizeof(integer));
+    input("snmp_input OCTET STRING, a number", ASN_OCTET_STR, "12345", 5);
+    input("snmp_input OCTET STRING, text", ASN_OCTET_STR,
+					"Linux gw 6.1.0 x86_64", 21);
+    input("snmp_input Counter32", ASN_COUNTER, &counter, sizeof(counter));
+    input("snmp_input Gauge32", ASN_GAUGE, &counter, sizeof(counter));
+    input("snmp_input Counter64", ASN_COUNTER64, &c64, sizeof(c64));
+    input("snmp_input TimeTicks", ASN_TIMETICKS, &ticks, sizeof(ticks));
+
+    /* a typical poll, all OIDs of a reader and the agent's sysUpTime */
+    b.ss = bench_session(MAX_OID_STR);
+    b.pdu = snmp_pdu_create(SNMP_MSG_RESPONSE);
+    for (i = 0; i < MAX_OID_STR; i++) {
+	bench_oid[OID_LENGTH(bench_oid) - 1] = i + 1;
+	snmp_pdu_add_variable(b.pdu, bench_oid, OID_LENGTH(bench_oid),
+			      ASN_COUNTER, (u_char *)&counter, sizeof(counter));
+    }
+    snmp_pdu_add_variable(b.pdu, sysUpTime, OID_LENGTH(sysUpTime),
+			  ASN_TIMETICKS, (u_char *)&ticks, sizeof(ticks));
+    bench_run("snmp_input 10 Counter32 + sysUpTime", bench_input, &b);
+    snmp_free_pdu(b.pdu);
+
+    return 0;
+}
@@ -0,0 +1,263 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+/*
+ * Microbenchmarks of the plugin's per-sample paths: the values, labels
+ * and tooltips of the readers, and the parsing of their configuration.
+ * The plugin is built right into this file to get at its static
+ * functions.  The GTK headers are needed to compile it, but nothing
+ * here touches GTK or a display: the linker drops the functions that
+ * would (see BENCH_CFLAGS in the Makefile), the few GKrellM functions
+ * reachable from the measured paths are stand-ins below.
+ */
+
+#include "gkrellm_snmp.c"
+#include "bench.h"
+
+
+gboolean
+gkrellm_dup_string(gchar **dst, gchar *src)
+{
+    if (!dst || (!*dst && !src))
+	return FALSE;
+    if (*dst) {
+	if (src && !strcmp(*dst, src))
+	    return FALSE;
+	g_free(*dst);
+    }
+    *dst = g_strdup(src);
+    return TRUE;
+}
+
+void
+gkrellm_message_dialog(gchar *title, gchar *message)
+{
+}
+
+gint
+gkrellm_get_chart_scalemax(GkrellmChart *cp)
+{
+    return 0;
+}
+
+void
+gkrellm_load_chartconfig(GkrellmChartconfig **config, gchar *string,
+			 gint max_cd)
+{
+}
+
+
+#define BENCH_READERS	500
+
+static volatile gdouble sink;
+
+/* A reader with 10 interface counters, sampled twice a second apart */
+static Reader *
+bench_reader(const gchar *format)
+{
+    Reader *reader;
+    sample_set *set;
+    gint i;
+
+    reader = g_new0(Reader, 1);
+    reader->label = g_strdup("eth0");
+    reader->peer = g_strdup("gw.example.net");
+    reader->port = 161;
+    reader->vers = 2;
+    reader->community = g_strdup("public");
+    reader->oid_base = g_strdup(".1.3.6.1.2.1.31.1.1.1.6.%s");
+    reader->oid_elements = g_strdup("1,2,3,4,5,6,7,8,9,10");
+    reader->formatString = g_strdup(format);
+    reader->delta = TRUE;
+    reader->divisor = 1;
+    reader->uptime = 123456789;
+    reader->base = samples_alloc(samples);
+    setup_samples(reader);
+
+    set = INPUT_FRONT(&reader->new_data);
+    reader->num_sample = set->num_sample = MAX_FORMAT_VALUES;
+    for (i = 0; i < reader->num_sample; i++) {
+	set->kind[i] = SAMPLE_COUNTER64;
+	samples_push(samples, reader->base + i, 1000000000 * (i + 1),
+		     G_USEC_PER_SEC, FALSE);
+	samples_push(samples, reader->base + i, 1000000000 * (i + 1)
+			+ 12345678 * (i + 1), 2 * G_USEC_PER_SEC, FALSE);
+	set->sample[i] = g_strdup_printf("%" G_GINT64_FORMAT,
+					 samples->cur[reader->base + i]);
+    }
+    reader->old_sample_time = G_USEC_PER_SEC;
+    reader->sample_time = 2 * G_USEC_PER_SEC;
+    samples_compute(samples);
+
+    reader->expression = g_strdup("rate($0)*8");
+    prepare_expression(reader);
+    reader->num_expr_value = 1;
+    reader->expr_value[0] = 8 * 12345678.0;
+    return reader;
+}
+
+static void
+free_reader(Reader *reader)
+{
+    gint i;
+
+    g_free(reader->label);
+    g_free(reader->peer);
+    g_free(reader->community);
+    g_free(reader->oid_base);
+    g_free(reader->oid_elements);
+    for (i = 0; i < MAX_OID_STR; i++)
+	g_free(reader->oid_str[i]);
+    g_free(reader->formatString);
+    g_free(reader->expression);
+    expr_free(reader->expr);
+    simpleSNMPfree_data(&reader->new_data);
+    g_free(reader->error);
+    g_free(reader->old_error);
+    g_free(reader);
+}
+
+static void
+bench_new_value(gpointer data)
+{
+    static gint i;
+
+    sink = new_value(data, i++ % MAX_FORMAT_VALUES);
+}
+
+static void
+bench_samples_compute(gpointer data)
+{
+    samples_compute(samples);
+}
+
+static void
+bench_render_label(gpointer data)
+{
+    g_free(render_label(data));
+}
+
+static void
+bench_render_info(gpointer data)
+{
+    g_free(render_info(data));
+}
+
+static void
+bench_prepare_oid_str(gpointer data)
+{
+    Reader *reader = data;
+    gint i;
+
+    prepare_oid_str(reader);
+    for (i = 0; i < reader->num_oid_str; i++) {
+	g_free(reader->oid_str[i]);
+	reader->oid_str[i] = NULL;
+    }
+}
+
+static void
+bench_load_config(gpointer data)
+{
+    gchar **lines = data;
+    Reader *reader;
+    gint i;
+
+    for (i = 0; lines[i]; i++)
+	load_plugin_config(lines[i]);
+    while (readers) {
+	reader = readers;
+	readers = reader->next;
+	free_reader(reader);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    static gchar *formats[] = {
+	"$L $0",
+	"$L $S0 $S1",
+	"$L\\n$S0/$S1 in $I, $X0 bit/s",
+	"$0 $1 $2 $3 $4 $5 $6 $7 $8 $9",
+    };
+    gchar *lines[BENCH_READERS + 1];
+    gchar *name;
+    Reader *reader, *more[100];
+    gint i;
+
+    bench_init();
+    /* no worker threads, nothing is polled here */
+    simpleSNMPsimulate(g_get_monotonic_time);
+    simpleSNMPinit();
+    samples = samples_new(MAX_FORMAT_VALUES);
+
+    reader = bench_reader(DEFAULT_FORMAT);
+    bench_run("new_value", bench_new_value, reader);
+    free_reader(reader);
+
+    /* 1000 slots in all */
+    for (i = 0; i < G_N_ELEMENTS(more); i++)
+	more[i] = bench_reader(DEFAULT_FORMAT);
+    bench_run("samples_compute, 1000 slots", bench_samples_compute, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+	reader = bench_reader(formats[i]);
+	name = g_strdup_printf("render_label \"%s\"", formats[i]);
+	bench_run(name, bench_render_label, reader);
+	g_free(name);
+	free_reader(reader);
+    }
+
+    reader = bench_reader(DEFAULT_FORMAT);
+    bench_run("render_info, 10 samples", bench_render_info, reader);
+    bench_run("prepare_oid_str, 10 elements", bench_prepare_oid_str, reader);
+    g_free(reader->oid_elements);
+    reader->oid_elements = g_strdup("");
+    bench_run("prepare_oid_str, 1 OID", bench_prepare_oid_str, reader);
+    free_reader(reader);
+
+    for (i = 0; i < G_N_ELEMENTS(more); i++)
+	free_reader(more[i]);
+
+    /* as written by save_plugin_config(), without the keyword */
+    for (i = 0; i < BENCH_READERS; i++)
+	lines[i] = g_strdup_printf("if%d snmp-v2c://public@gw%d:161/"
+		".1.3.6.1.2.1.31.1.1.1.%%s _ 100 1 8 0 1 $L_$S0_$S1 0 "
+		"6.%d,10.%d _rate($0)+rate($1)", i, i % 16, i + 1, i + 1);
+    lines[i] = NULL;
+    name = g_strdup_printf("load_plugin_config, %d readers", BENCH_READERS);
+    bench_run(name, bench_load_config, lines);
+    g_free(name);
+
+    return 0;
+}
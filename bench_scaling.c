@@ -0,0 +1,186 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+/*
+ * Headless throughput benchmark for the sharded SNMP engine.
+ *
+ * Polls a number of agents (one per UDP port on the given host, e.g. a
+ * local snmpsimd with several endpoints) with 1 up to max worker threads
+ * and prints the resulting varbinds/s, i.e. the scaling curve.  Sessions
+ * of an agent polling the same OIDs share the values, only the varbinds
+ * fetched from the agents count.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <simpleSNMP.h>
+
+
+static void
+usage()
+{
+    fprintf(stderr,
+	"usage: bench_scaling [-a agents] [-n sessions] [-p port] [-c community]\n"
+	"                     [-i interval_ms] [-d seconds] [-t max_threads]\n"
+	"                     [host [oid...]]\n"
+	"  agents are polled on ports port .. port+agents-1,\n"
+	"  over TCP if host is given as tcp:host\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    gchar *host = "127.0.0.1";
+    gchar *community = "public";
+    gchar *default_oids[] = { "system.sysDescr.0", "system.sysName.0" };
+    gchar **oids = default_oids;
+    gint num_oids = 2;
+    gint agents = 64;
+    gint sessions = 1024;
+    gint port = 1161;
+    gint interval_ms = 100;
+    gint seconds = 5;
+    gint max_threads = g_get_num_processors();
+    simple_session **ss;
+    input_data *data;
+    gint *answered;		/* 1 if answered, -1 after a timeout */
+    struct rlimit limit;
+    gint64 start, elapsed;
+    gdouble rate, base = 0;
+    glong values;
+    gint opt, threads, i, silent;
+
+    while ((opt = getopt(argc, argv, "a:n:p:c:i:d:t:")) != -1) {
+	switch (opt) {
+	case 'a': agents = atoi(optarg); break;
+	case 'n': sessions = atoi(optarg); break;
+	case 'p': port = atoi(optarg); break;
+	case 'c': community = optarg; break;
+	case 'i': interval_ms = atoi(optarg); break;
+	case 'd': seconds = atoi(optarg); break;
+	case 't': max_threads = atoi(optarg); break;
+	default: usage();
+	}
+    }
+    if (optind < argc)
+	host = argv[optind++];
+    if (optind < argc) {
+	oids = &argv[optind];
+	num_oids = MIN(argc - optind, MAX_OID_STR);
+    }
+    if (agents < 1 || sessions < 1 || interval_ms < 1 || seconds < 1)
+	usage();
+
+    /* a socket per UDP session, past the usual soft limit of 1024 */
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0
+	    && limit.rlim_cur < limit.rlim_max) {
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    simpleSNMPinit();
+
+    ss = g_new0(simple_session *, sessions);
+    data = g_new0(input_data, sessions);
+    answered = g_new0(gint, sessions);
+
+    printf("# %d sessions on %d agents at %s:%d, %d varbinds every %d ms\n",
+	   sessions, agents, host, port, num_oids, interval_ms);
+    printf("# threads  varbinds/s  speedup  silent sessions\n");
+
+    for (threads = 1; threads <= max_threads; threads++) {
+	simpleSNMPset_threads(threads);
+
+	for (i = 0; i < sessions; i++) {
+	    ss[i] = simpleSNMPopen(host, port + i % agents, 2, community,
+						TRANSPORT_UDP, &data[i]);
+	    simpleSNMPpoll(ss[i], oids, NULL, num_oids,
+				(gint64)interval_ms * 1000);
+	}
+
+	/* let the sessions settle, then measure */
+	g_usleep(G_USEC_PER_SEC / 2);
+	simpleSNMPupdate();
+
+	values = 0;
+	memset(answered, 0, sessions * sizeof(gint));
+	start = g_get_monotonic_time();
+	do {
+	    g_usleep(1000);
+	    values += simpleSNMPupdate();
+	    /*
+	     * A session whose socket isn't watched times out on what it
+	     * fetches itself, though it may get shared values in between.
+	     */
+	    for (i = 0; i < sessions; i++) {
+		if (!data[i].new)
+		    continue;
+		if (data[i].error) {
+		    g_free(data[i].error);
+		    data[i].error = NULL;
+		    data[i].new = 0;
+		    answered[i] = -1;
+		} else {
+		    simpleSNMPswap(&data[i]);
+		    if (answered[i] == 0)
+			answered[i] = 1;
+		}
+	    }
+	    elapsed = g_get_monotonic_time() - start;
+	} while (elapsed < (gint64)seconds * G_USEC_PER_SEC);
+
+	silent = 0;
+	for (i = 0; i < sessions; i++)
+	    if (answered[i] != 1)
+		silent++;
+	rate = values * (gdouble)G_USEC_PER_SEC / elapsed;
+	if (threads == 1)
+	    base = rate;
+	printf("%9d  %10.0f  %7.2f  %15d\n", threads, rate,
+				base > 0 ? rate / base : 0.0, silent);
+	fflush(stdout);
+
+	for (i = 0; i < sessions; i++) {
+	    simpleSNMPclose(ss[i]);
+	    simpleSNMPfree_data(&data[i]);
+	}
+	memset(data, 0, sessions * sizeof(input_data));
+	/* collect the released handles */
+	g_usleep(G_USEC_PER_SEC / 10);
+	simpleSNMPupdate();
+    }
+
+    return 0;
+}
@@ -0,0 +1,381 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+
+#include "capture.h"
+
+
+#define CAPTURE_MAGIC	0x434d4e53	/* "SNMC" */
+#define CAPTURE_VERSION	1
+
+/* The most varbinds or OIDs in a record */
+#define CAPTURE_MAX_VAR	255
+
+typedef struct {
+	guint32			magic;
+	guint32			version;
+} CaptureHeader;
+
+/*
+ * Each record is followed by len bytes: for requests and responses the
+ * varbinds, each a CaptureVar, its name as 32 bit subids and its value;
+ * for sessions a CaptureSetup, the refresh classes as 32 bit numbers
+ * and the peer name, the community and the OIDs as 0 terminated strings.
+ */
+typedef struct {
+	guint8			kind;
+	guint8			errstat;
+	guint8			errindex;
+	guint8			num_var;
+	guint32			session;
+	gint32			reqid;
+	guint32			len;
+	gint64			time;
+} CaptureRecord;
+
+typedef struct {
+	guint8			name_length;
+	guint8			type;
+	guint16			val_len;
+} CaptureVar;
+
+typedef struct {
+	gint64			interval;
+	guint32			port;
+	guint32			version;
+} CaptureSetup;
+
+struct Capture {
+	FILE			*file;
+	gboolean		writing;
+	GMutex			lock;		/* the shards write concurrently */
+	gint64			start;		/* monotonic usec */
+	GByteArray		*buf;
+};
+
+
+Capture *
+capture_create(const gchar *path)
+{
+    Capture *capture;
+    CaptureHeader header;
+    FILE *file;
+    gint fd;
+
+    /* it may contain community strings */
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || !(file = fdopen(fd, "w"))) {
+	perror(path);
+	if (fd >= 0)
+	    close(fd);
+	return NULL;
+    }
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    fwrite(&header, sizeof(header), 1, file);
+
+    capture = g_new0(Capture, 1);
+    capture->file = file;
+    capture->writing = TRUE;
+    g_mutex_init(&capture->lock);
+    capture->start = g_get_monotonic_time();
+    capture->buf = g_byte_array_new();
+    return capture;
+}
+
+static void
+write_record(Capture *capture, CaptureRecord *record)
+{
+    record->len = capture->buf->len;
+    fwrite(record, sizeof(*record), 1, capture->file);
+    fwrite(capture->buf->data, 1, capture->buf->len, capture->file);
+    g_byte_array_set_size(capture->buf, 0);
+}
+
+void
+capture_session(Capture *capture, guint session,
+		struct snmp_session *template,
+		gchar **oid_str, gint *refresh, gint num_oid, gint64 interval)
+{
+    CaptureRecord record;
+    CaptureSetup setup;
+    guint32 n;
+    gchar *community;
+    gint i;
+
+    if (!capture)
+	return;
+    num_oid = MIN(num_oid, CAPTURE_MAX_VAR);
+    /* v3 passphrases stay out of the file */
+    community = template->version == SNMP_VERSION_3 || !template->community
+			? "" : (gchar *)template->community;
+
+    memset(&record, 0, sizeof(record));
+    record.kind = CAPTURE_SESSION;
+    record.num_var = num_oid;
+    record.session = session;
+
+    g_mutex_lock(&capture->lock);
+    record.time = g_get_monotonic_time() - capture->start;
+    setup.interval = interval;
+    setup.port = template->remote_port;
+    setup.version = template->version;
+    g_byte_array_append(capture->buf, (guint8 *)&setup, sizeof(setup));
+    for (i = 0; i < num_oid; i++) {
+	n = refresh ? refresh[i] : 1;
+	g_byte_array_append(capture->buf, (guint8 *)&n, sizeof(n));
+    }
+    g_byte_array_append(capture->buf, (guint8 *)template->peername,
+					strlen(template->peername) + 1);
+    g_byte_array_append(capture->buf, (guint8 *)community,
+					strlen(community) + 1);
+    for (i = 0; i < num_oid; i++)
+	g_byte_array_append(capture->buf, (guint8 *)oid_str[i],
+					strlen(oid_str[i]) + 1);
+    write_record(capture, &record);
+    /* a session record is rare, and useless if lost in the buffer */
+    fflush(capture->file);
+    g_mutex_unlock(&capture->lock);
+}
+
+void
+capture_pdu(Capture *capture, gint kind, guint session, gint reqid,
+	    gint64 time, struct snmp_pdu *pdu)
+{
+    CaptureRecord record;
+    CaptureVar var;
+    struct variable_list *vars;
+    guint32 subid;
+    gsize k;
+
+    if (!capture)
+	return;
+
+    memset(&record, 0, sizeof(record));
+    record.kind = kind;
+    record.session = session;
+    record.reqid = reqid;
+
+    g_mutex_lock(&capture->lock);
+    record.time = time - capture->start;
+    if (pdu) {
+	record.errstat = MIN(pdu->errstat, 255);
+	record.errindex = MIN(pdu->errindex, 255);
+	for (vars = pdu->variables; vars && record.num_var < CAPTURE_MAX_VAR;
+					vars = vars->next_variable) {
+	    var.name_length = MIN(vars->name_length, 255);
+	    var.type = vars->type;
+	    /* the requests have no values */
+	    var.val_len = kind == CAPTURE_RESPONSE && vars->val.string
+				? MIN(vars->val_len, G_MAXUINT16) : 0;
+	    g_byte_array_append(capture->buf, (guint8 *)&var, sizeof(var));
+	    for (k = 0; k < var.name_length; k++) {
+		subid = vars->name[k];
+		g_byte_array_append(capture->buf, (guint8 *)&subid,
+							sizeof(subid));
+	    }
+	    g_byte_array_append(capture->buf, vars->val.string, var.val_len);
+	    record.num_var++;
+	}
+    }
+    write_record(capture, &record);
+    g_mutex_unlock(&capture->lock);
+}
+
+
+Capture *
+capture_open(const gchar *path)
+{
+    Capture *capture;
+    CaptureHeader header;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file) {
+	perror(path);
+	return NULL;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1
+	    || header.magic != CAPTURE_MAGIC
+	    || header.version != CAPTURE_VERSION) {
+	fprintf(stderr, "%s: not a capture of this version\n", path);
+	fclose(file);
+	return NULL;
+    }
+
+    capture = g_new0(Capture, 1);
+    capture->file = file;
+    g_mutex_init(&capture->lock);
+    capture->buf = g_byte_array_new();
+    return capture;
+}
+
+static struct snmp_pdu *
+read_pdu(CaptureRecord *record, guint8 *p, guint8 *end)
+{
+    struct snmp_pdu *pdu;
+    CaptureVar var;
+    oid name[256];
+    guint32 subid;
+    gint i, k;
+
+    pdu = snmp_pdu_create(record->kind == CAPTURE_REQUEST
+				? SNMP_MSG_GET : SNMP_MSG_RESPONSE);
+    pdu->errstat = record->errstat;
+    pdu->errindex = record->errindex;
+    for (i = 0; i < record->num_var; i++) {
+	if (p + sizeof(var) > end)
+	    break;
+	memcpy(&var, p, sizeof(var));
+	p += sizeof(var);
+	if (p + var.name_length * sizeof(subid) + var.val_len > end)
+	    break;
+	for (k = 0; k < var.name_length; k++, p += sizeof(subid)) {
+	    memcpy(&subid, p, sizeof(subid));
+	    name[k] = subid;
+	}
+	/* w/o a value, e.g. noSuchObject, keeps its type */
+	snmp_pdu_add_variable(pdu, name, var.name_length, var.type,
+			      var.val_len ? p : NULL, var.val_len);
+	p += var.val_len;
+    }
+    return pdu;
+}
+
+static gboolean
+read_session(CaptureEntry *entry, CaptureRecord *record,
+	     guint8 *p, guint8 *end)
+{
+    CaptureSetup setup;
+    guint32 n;
+    gchar *s;
+    gint i;
+
+    if (p + sizeof(setup) + record->num_var * sizeof(n) > end || end[-1])
+	return FALSE;
+    memcpy(&setup, p, sizeof(setup));
+    p += sizeof(setup);
+    entry->interval = setup.interval;
+    entry->port = setup.port;
+    entry->version = setup.version;
+    entry->refresh = g_new0(gint, record->num_var);
+    for (i = 0; i < record->num_var; i++, p += sizeof(n)) {
+	memcpy(&n, p, sizeof(n));
+	entry->refresh[i] = n;
+    }
+
+    /* the strings are 0 terminated, the last one at end[-1] */
+    s = (gchar *)p;
+    entry->peername = g_strdup(s);
+    s += strlen(s) + 1;
+    if (s >= (gchar *)end)
+	return FALSE;
+    entry->community = g_strdup(s);
+    s += strlen(s) + 1;
+    entry->oid_str = g_new0(gchar *, record->num_var);
+    for (i = 0; i < record->num_var && s < (gchar *)end; i++) {
+	entry->oid_str[i] = g_strdup(s);
+	s += strlen(s) + 1;
+    }
+    entry->num_oid = i;
+    return TRUE;
+}
+
+/* The next record, FALSE at the end of the file or if it's cut short */
+gboolean
+capture_next(Capture *capture, CaptureEntry *entry)
+{
+    CaptureRecord record;
+    guint8 *p, *end;
+
+    memset(entry, 0, sizeof(*entry));
+    if (fread(&record, sizeof(record), 1, capture->file) != 1)
+	return FALSE;
+    g_byte_array_set_size(capture->buf, record.len);
+    if (record.len
+	    && fread(capture->buf->data, record.len, 1, capture->file) != 1)
+	return FALSE;
+    p = capture->buf->data;
+    end = p + record.len;
+
+    entry->kind = record.kind;
+    entry->session = record.session;
+    entry->reqid = record.reqid;
+    entry->time = record.time;
+    switch (record.kind) {
+    case CAPTURE_SESSION:
+	if (!read_session(entry, &record, p, end)) {
+	    capture_entry_clear(entry);
+	    return FALSE;
+	}
+	break;
+    case CAPTURE_REQUEST:
+    case CAPTURE_RESPONSE:
+	entry->pdu = read_pdu(&record, p, end);
+	break;
+    }
+    return TRUE;
+}
+
+void
+capture_entry_clear(CaptureEntry *entry)
+{
+    gint i;
+
+    if (entry->pdu)
+	snmp_free_pdu(entry->pdu);
+    g_free(entry->peername);
+    g_free(entry->community);
+    for (i = 0; i < entry->num_oid; i++)
+	g_free(entry->oid_str[i]);
+    g_free(entry->oid_str);
+    g_free(entry->refresh);
+    memset(entry, 0, sizeof(*entry));
+}
+
+void
+capture_close(Capture *capture)
+{
+    if (!capture)
+	return;
+    fclose(capture->file);
+    g_mutex_clear(&capture->lock);
+    g_byte_array_free(capture->buf, TRUE);
+    g_free(capture);
+}
@@ -0,0 +1,89 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+
+#include <glib.h>
+
+
+/*
+ * A capture of the SNMP traffic of the plugin, for replaying it later
+ * without agents (see replay_snmp.c).  The file is a header followed by
+ * records: the sessions as they were set up, and each request, response
+ * and timeout with its reqid and a usec timestamp since the capture
+ * started.  Varbinds are kept with their raw value, it's meant to be
+ * read on the host that wrote it, so it's in native byte order.
+ */
+
+enum {
+    CAPTURE_SESSION,
+    CAPTURE_REQUEST,
+    CAPTURE_RESPONSE,
+    CAPTURE_TIMEOUT
+};
+
+struct snmp_session;
+struct snmp_pdu;
+
+typedef struct Capture Capture;
+
+/* A record as read back */
+typedef struct {
+	gint			kind;
+	guint			session;
+	gint			reqid;
+	gint64			time;		/* usec since the start */
+	/* requests and responses, owned by the entry */
+	struct snmp_pdu		*pdu;
+	/* sessions */
+	gchar			*peername;	/* with the transport, tcp:... */
+	gint			port;
+	gint			version;	/* SNMP_VERSION_... */
+	gchar			*community;	/* "" for v3 */
+	gint64			interval;
+	gint			num_oid;
+	gchar			**oid_str;
+	gint			*refresh;
+} CaptureEntry;
+
+extern	Capture *capture_create(const gchar *path);
+extern	void capture_session(Capture *capture, guint session,
+				struct snmp_session *template,
+				gchar **oid_str, gint *refresh, gint num_oid,
+				gint64 interval);
+extern	void capture_pdu(Capture *capture, gint kind, guint session,
+				gint reqid, gint64 time, struct snmp_pdu *pdu);
+
+extern	Capture *capture_open(const gchar *path);
+extern	gboolean capture_next(Capture *capture, CaptureEntry *entry);
+extern	void capture_entry_clear(CaptureEntry *entry);
+
+extern	void capture_close(Capture *capture);
@@ -0,0 +1,288 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#define RECEIVED_MESSAGE NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE
+
+#include "discover.h"
+
+
+/* system.sysDescr.0, sysObjectID.0 and sysName.0 */
+static oid sysDescr[] = { 1, 3, 6, 1, 2, 1, 1, 1, 0 };
+static oid sysObjectID[] = { 1, 3, 6, 1, 2, 1, 1, 2, 0 };
+static oid sysName[] = { 1, 3, 6, 1, 2, 1, 1, 5, 0 };
+
+/* A request in flight, a slot of the window */
+typedef struct {
+	void			*sessp;		/* NULL if the slot is free */
+	gint64			sent;		/* monotonic usec */
+	gboolean		done;
+	gboolean		answered;
+	DiscoverAgent		agent;
+} Probe;
+
+/* Parse a.b.c.d/n into the first and last address, in host order */
+static gboolean
+parse_cidr(const gchar *cidr, guint32 *first, guint32 *last)
+{
+    gchar addr[INET_ADDRSTRLEN];
+    const gchar *slash;
+    struct in_addr in;
+    guint32 mask;
+    gint bits = 32;
+
+    slash = strchr(cidr, '/');
+    if (slash) {
+	if (slash - cidr >= sizeof(addr) || sscanf(slash + 1, "%d", &bits) != 1
+		|| bits < 0 || bits > 32)
+	    return FALSE;
+	memcpy(addr, cidr, slash - cidr);
+	addr[slash - cidr] = '\0';
+    } else {
+	g_strlcpy(addr, cidr, sizeof(addr));
+    }
+    if (inet_pton(AF_INET, addr, &in) != 1)
+	return FALSE;
+
+    mask = bits ? 0xffffffffU << (32 - bits) : 0;
+    *first = ntohl(in.s_addr) & mask;
+    *last = *first | ~mask;
+    /* leave out the network and the broadcast address */
+    if (bits < 31) {
+	(*first)++;
+	(*last)--;
+    }
+    return TRUE;
+}
+
+static gchar *
+var_string(struct variable_list *vars)
+{
+    GString *dotted;
+    gint i;
+
+    if (vars->type == ASN_OCTET_STR)
+	return g_strndup((gchar *)vars->val.string, vars->val_len);
+    if (vars->type != ASN_OBJECT_ID)
+	return g_strdup("");
+    dotted = g_string_new("");
+    for (i = 0; i < vars->val_len / sizeof(oid); i++)
+	g_string_append_printf(dotted, ".%lu", (gulong)vars->val.objid[i]);
+    return g_string_free(dotted, FALSE);
+}
+
+static int
+probe_input(int op,
+	    struct snmp_session *session,
+	    int reqid,
+	    struct snmp_pdu *pdu,
+	    void *magic)
+{
+    Probe *probe = magic;
+    struct variable_list *vars;
+    gchar **field;
+
+    probe->done = TRUE;
+    if (op != RECEIVED_MESSAGE)
+	return 1;
+    /* any answer is an agent, even one refusing some of the OIDs */
+    probe->answered = TRUE;
+    probe->agent.rtt = g_get_monotonic_time() - probe->sent;
+    for (vars = pdu->variables; vars; vars = vars->next_variable) {
+	if (snmp_oid_compare(vars->name, vars->name_length,
+			     sysDescr, OID_LENGTH(sysDescr)) == 0)
+	    field = &probe->agent.descr;
+	else if (snmp_oid_compare(vars->name, vars->name_length,
+				  sysObjectID, OID_LENGTH(sysObjectID)) == 0)
+	    field = &probe->agent.object_id;
+	else if (snmp_oid_compare(vars->name, vars->name_length,
+				  sysName, OID_LENGTH(sysName)) == 0)
+	    field = &probe->agent.name;
+	else
+	    continue;
+	g_free(*field);
+	*field = var_string(vars);
+    }
+    return 1;
+}
+
+static gboolean
+probe_send(Probe *probe, guint32 addr, gint port, gint vers,
+	   const gchar *community, gint64 timeout, gint retries)
+{
+    struct snmp_session session;
+    struct snmp_pdu *pdu;
+    struct in_addr in;
+    gchar peer[INET_ADDRSTRLEN];
+    gchar *peername;
+
+    in.s_addr = htonl(addr);
+    inet_ntop(AF_INET, &in, peer, sizeof(peer));
+
+    snmp_sess_init(&session);
+    session.version = vers == 1 ? SNMP_VERSION_1 : SNMP_VERSION_2c;
+    session.community = (u_char *)community;
+    session.community_len = strlen(community);
+    peername = g_strdup_printf("udp:%s:%d", peer, port);
+    session.peername = peername;
+    session.timeout = timeout;
+    session.retries = retries;
+    probe->sessp = snmp_sess_open(&session);
+    g_free(peername);
+    if (probe->sessp == NULL)
+	return FALSE;
+
+    pdu = snmp_pdu_create(SNMP_MSG_GET);
+    snmp_add_null_var(pdu, sysDescr, OID_LENGTH(sysDescr));
+    snmp_add_null_var(pdu, sysObjectID, OID_LENGTH(sysObjectID));
+    snmp_add_null_var(pdu, sysName, OID_LENGTH(sysName));
+    memset(&probe->agent, 0, sizeof(probe->agent));
+    probe->agent.peer = g_strdup(peer);
+    probe->done = FALSE;
+    probe->answered = FALSE;
+    probe->sent = g_get_monotonic_time();
+    if (!snmp_sess_async_send(probe->sessp, pdu, probe_input, probe)) {
+	snmp_free_pdu(pdu);
+	snmp_sess_close(probe->sessp);
+	probe->sessp = NULL;
+	g_free(probe->agent.peer);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+probe_finish(Probe *probe, DiscoverFunc found, gpointer data)
+{
+    DiscoverAgent *agent = &probe->agent;
+
+    snmp_sess_close(probe->sessp);
+    probe->sessp = NULL;
+    if (probe->answered) {
+	if (!agent->descr) agent->descr = g_strdup("");
+	if (!agent->object_id) agent->object_id = g_strdup("");
+	if (!agent->name) agent->name = g_strdup("");
+	found(agent, data);
+    }
+    g_free(agent->peer);
+    g_free(agent->descr);
+    g_free(agent->object_id);
+    g_free(agent->name);
+}
+
+/*
+ * Sweep the addresses of cidr (a.b.c.d/n) on the given UDP port with v1
+ * or v2c, calling found for each agent that answers.  timeout is in usec
+ * per try.  Returns the addresses asked, or -1 and an error message.
+ */
+gint
+discover_sweep(const gchar *cidr, gint port, gint vers,
+	       const gchar *community, gint window,
+	       gint64 timeout, gint retries,
+	       DiscoverFunc found, gpointer data, gchar **error)
+{
+    Probe *probes;
+    guint32 first, last;
+    guint64 next;
+    gint active = 0, asked = 0;
+    gint i, count, numfds, block;
+    fd_set fdset;
+    struct timeval wait, sess_wait;
+
+    if (!parse_cidr(cidr, &first, &last)) {
+	*error = g_strdup_printf("not an IPv4 address or range: %s", cidr);
+	return -1;
+    }
+    window = CLAMP(window, 1, DISCOVER_MAX_WINDOW);
+    probes = g_new0(Probe, window);
+
+    next = first;
+    while (next <= last || active > 0) {
+	/* keep the window full */
+	for (i = 0; i < window && next <= last; i++) {
+	    if (probes[i].sessp)
+		continue;
+	    /* an address that can't be asked is left out, like a silent one */
+	    if (probe_send(&probes[i], next, port, vers, community,
+			   timeout, retries))
+		active++;
+	    next++;
+	    asked++;
+	}
+
+	numfds = 0;
+	FD_ZERO(&fdset);
+	wait.tv_sec = 1;
+	wait.tv_usec = 0;
+	for (i = 0; i < window; i++) {
+	    if (!probes[i].sessp)
+		continue;
+	    block = 1;
+	    snmp_sess_select_info(probes[i].sessp, &numfds, &fdset,
+				  &sess_wait, &block);
+	    if (!block && timercmp(&sess_wait, &wait, <))
+		wait = sess_wait;
+	}
+	if (active == 0)
+	    continue;
+	count = select(numfds, &fdset, 0, 0, &wait);
+	if (count < 0 && errno != EINTR) {
+	    fprintf(stderr, "discover: error on select\n");
+	    break;
+	}
+	for (i = 0; i < window; i++) {
+	    if (!probes[i].sessp)
+		continue;
+	    if (count > 0)
+		snmp_sess_read(probes[i].sessp, &fdset);
+	    snmp_sess_timeout(probes[i].sessp);
+	    if (probes[i].done) {
+		probe_finish(&probes[i], found, data);
+		active--;
+	    }
+	}
+    }
+
+    /* only after an error on select() */
+    for (i = 0; i < window; i++)
+	if (probes[i].sessp)
+	    probe_finish(&probes[i], found, data);
+    g_free(probes);
+    return asked;
+}
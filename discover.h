@@ -0,0 +1,63 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+
+
+#include <glib.h>
+
+
+/*
+ * A sweep of an IPv4 range for SNMP agents (see discover_snmp.c).  Each
+ * address is asked for sysDescr, sysObjectID and sysName with one async
+ * GET, up to a window of them in flight at once, so a sweep takes about
+ * the addresses over the window times the timeout, not their sum.
+ */
+
+/* An agent that answered */
+typedef struct {
+	gchar			*peer;		/* the address */
+	gchar			*descr;		/* sysDescr, "" if none */
+	gchar			*object_id;	/* sysObjectID dotted, "" if none */
+	gchar			*name;		/* sysName, "" if none */
+	gint64			rtt;		/* usec */
+} DiscoverAgent;
+
+typedef void (*DiscoverFunc)(DiscoverAgent *agent, gpointer data);
+
+/* The most requests in flight, each takes a socket for select() */
+#define DISCOVER_MAX_WINDOW	512
+
+extern	gint discover_sweep(const gchar *cidr, gint port, gint vers,
+				const gchar *community, gint window,
+				gint64 timeout, gint retries,
+				DiscoverFunc found, gpointer data,
+				gchar **error);
@@ -0,0 +1,373 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+/*
+ * Finds the SNMP agents in IPv4 ranges and writes reader definitions for
+ * them, to be appended to ~/.gkrellm2/user-config while GKrellM isn't
+ * running.  The ranges are swept with many async GETs in flight at once
+ * (see discover.h).  The agents are classified by the enterprise of
+ * their sysObjectID, and get the readers of the templates whose
+ * sysObjectID prefix matches theirs the longest.
+ *
+ * A template is a line of a template file: a sysObjectID prefix, or "."
+ * for any agent, followed by a reader definition as in user-config after
+ * "snmp_monitor", with {label}, {host}, {port}, {community}, {scheme} and
+ * {name} filled in.  {label} is the agent's sysName, made unique, else
+ * its address.  Spaces in a format go as '_', like in user-config.
+ *
+ * Against snmpsimd listening on a few loopback addresses, e.g.
+ *   discover_snmp -p 1161 127.0.0.0/22
+ * asks 1022 addresses in about 4 timeouts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+
+#include <discover.h>
+
+
+#define PLUGIN_CONFIG_KEYWORD	"snmp_monitor"
+#define ENTERPRISES		".1.3.6.1.4.1."
+
+typedef struct {
+	gchar			*prefix;	/* "" for any agent */
+	gchar			*definition;
+} Template;
+
+/* Without a template file: the traffic of each agent's first interface */
+static gchar *default_templates[] = {
+    ". {label}_if1 {scheme}://{community}@{host}:{port}/"
+	".1.3.6.1.2.1.2.2.1.%s.1 _ 100 1 1 0 0 $L_in_$0_out_$1 0 10,16 _"
+};
+
+/* Some well known enterprise numbers, for the classes */
+static struct {
+    gint number;
+    gchar *name;
+} enterprises[] = {
+    { 9, "Cisco" },
+    { 11, "HP" },
+    { 43, "3Com" },
+    { 311, "Microsoft" },
+    { 318, "APC" },
+    { 674, "Dell" },
+    { 1916, "Extreme" },
+    { 2011, "Huawei" },
+    { 2636, "Juniper" },
+    { 3375, "F5" },
+    { 4526, "Netgear" },
+    { 6876, "VMware" },
+    { 8072, "Net-SNMP" },
+    { 12356, "Fortinet" },
+    { 14988, "MikroTik" },
+    { 25461, "Palo Alto" },
+    { 41112, "Ubiquiti" }
+};
+
+typedef struct {
+	GPtrArray		*templates;
+	gint			port;
+	gint			vers;
+	gchar			*community;
+	GHashTable		*labels;	/* in use */
+	GHashTable		*classes;	/* agents per class */
+	GPtrArray		*class_order;	/* as first seen */
+	gint			agents;
+	gint			readers;
+} Discovery;
+
+static void
+usage()
+{
+    fprintf(stderr,
+	"usage: discover_snmp [-p port] [-v 1|2] [-c community] [-w window]\n"
+	"                     [-t timeout_ms] [-r retries] [-f templates]\n"
+	"                     a.b.c.d/n ...\n"
+	"  -w  requests in flight at once, at most %d\n"
+	"  -f  the reader templates, one per line: a sysObjectID prefix or\n"
+	"      '.' for any agent, and a reader definition with {label},\n"
+	"      {host}, {port}, {community}, {scheme} and {name}\n"
+	"  the readers go to stdout, the agents found to stderr\n",
+	DISCOVER_MAX_WINDOW);
+    exit(1);
+}
+
+static void
+add_template(GPtrArray *templates, const gchar *line)
+{
+    Template *template;
+    gchar **fields;
+
+    while (*line == ' ' || *line == '\t')
+	line++;
+    if (*line == '\0' || *line == '#')
+	return;
+    fields = g_strsplit_set(line, " \t", 2);
+    if (fields[0] && fields[1]) {
+	template = g_new0(Template, 1);
+	template->prefix = g_strdup(strcmp(fields[0], ".") ? fields[0] : "");
+	template->definition = g_strstrip(g_strdup(fields[1]));
+	g_ptr_array_add(templates, template);
+    }
+    g_strfreev(fields);
+}
+
+static gboolean
+load_templates(GPtrArray *templates, const gchar *path)
+{
+    gchar *text, **lines;
+    gint i;
+
+    if (!g_file_get_contents(path, &text, NULL, NULL))
+	return FALSE;
+    lines = g_strsplit(text, "\n", -1);
+    for (i = 0; lines[i]; i++)
+	add_template(templates, lines[i]);
+    g_strfreev(lines);
+    g_free(text);
+    return TRUE;
+}
+
+/* The length of a prefix of object_id, on a subid boundary, else -1 */
+static gint
+prefix_match(const gchar *prefix, const gchar *object_id)
+{
+    gint len = strlen(prefix);
+
+    if (len == 0)
+	return 0;
+    if (strncmp(prefix, object_id, len) != 0)
+	return -1;
+    if (object_id[len] != '\0' && object_id[len] != '.')
+	return -1;
+    return len;
+}
+
+static gchar *
+agent_class(DiscoverAgent *agent)
+{
+    gint number, i;
+
+    if (!g_str_has_prefix(agent->object_id, ENTERPRISES))
+	return g_strdup(agent->object_id[0] ? agent->object_id : "unknown");
+    number = atoi(agent->object_id + strlen(ENTERPRISES));
+    for (i = 0; i < G_N_ELEMENTS(enterprises); i++)
+	if (enterprises[i].number == number)
+	    return g_strdup(enterprises[i].name);
+    return g_strdup_printf("enterprise %d", number);
+}
+
+/* The agent's sysName as a label, unique among the agents found */
+static gchar *
+agent_label(Discovery *discovery, DiscoverAgent *agent)
+{
+    gchar *label, *unique;
+    gchar *c;
+
+    label = g_strdup(agent->name[0] ? agent->name : agent->peer);
+    for (c = label; *c; c++)
+	if (!g_ascii_isalnum(*c) && *c != '-' && *c != '.')
+	    *c = '_';
+    if (g_hash_table_lookup(discovery->labels, label)) {
+	unique = g_strdup_printf("%s_%s", label, agent->peer);
+	g_free(label);
+	label = unique;
+    }
+    g_hash_table_insert(discovery->labels, label, label);
+    return label;
+}
+
+static gchar *
+expand(const gchar *definition, const gchar *label, DiscoverAgent *agent,
+       Discovery *discovery)
+{
+    GString *out;
+    gchar *name;
+    const gchar *p, *end;
+
+    name = g_strdelimit(g_strdup(agent->name[0] ? agent->name : "_"),
+			" \t", '_');
+    out = g_string_new("");
+    for (p = definition; *p; p++) {
+	end = *p == '{' ? strchr(p, '}') : NULL;
+	if (!end) {
+	    g_string_append_c(out, *p);
+	    continue;
+	}
+	if (!strncmp(p, "{label}", end - p + 1))
+	    g_string_append(out, label);
+	else if (!strncmp(p, "{host}", end - p + 1))
+	    g_string_append(out, agent->peer);
+	else if (!strncmp(p, "{port}", end - p + 1))
+	    g_string_append_printf(out, "%d", discovery->port);
+	else if (!strncmp(p, "{community}", end - p + 1))
+	    g_string_append(out, discovery->community);
+	else if (!strncmp(p, "{scheme}", end - p + 1))
+	    g_string_append(out, discovery->vers == 1 ? "snmp" : "snmp-v2c");
+	else if (!strncmp(p, "{name}", end - p + 1))
+	    g_string_append(out, name);
+	else {
+	    g_string_append_c(out, *p);
+	    continue;
+	}
+	p = end;
+    }
+    g_free(name);
+    return g_string_free(out, FALSE);
+}
+
+static void
+found(DiscoverAgent *agent, gpointer data)
+{
+    Discovery *discovery = data;
+    Template *template;
+    gchar *class, *label, *definition, *descr;
+    gint best = -1, len, i;
+
+    class = agent_class(agent);
+    i = GPOINTER_TO_INT(g_hash_table_lookup(discovery->classes, class));
+    if (i == 0)
+	g_ptr_array_add(discovery->class_order, g_strdup(class));
+    g_hash_table_replace(discovery->classes, class, GINT_TO_POINTER(i + 1));
+    discovery->agents++;
+
+    /* the first line of sysDescr is enough to tell them apart */
+    descr = g_strndup(agent->descr, strcspn(agent->descr, "\r\n"));
+    fprintf(stderr, "# %-15s %-12s %6.1f ms %s %s %s\n", agent->peer, class,
+	    agent->rtt / 1000.0, agent->object_id[0] ? agent->object_id : "-",
+	    agent->name[0] ? agent->name : "-", descr);
+    g_free(descr);
+
+    for (i = 0; i < discovery->templates->len; i++) {
+	template = g_ptr_array_index(discovery->templates, i);
+	best = MAX(best, prefix_match(template->prefix, agent->object_id));
+    }
+    if (best < 0)
+	return;
+    label = agent_label(discovery, agent);
+    for (i = 0; i < discovery->templates->len; i++) {
+	template = g_ptr_array_index(discovery->templates, i);
+	len = prefix_match(template->prefix, agent->object_id);
+	if (len != best)
+	    continue;
+	definition = expand(template->definition, label, agent, discovery);
+	printf("%s %s\n", PLUGIN_CONFIG_KEYWORD, definition);
+	g_free(definition);
+	discovery->readers++;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    Discovery discovery;
+    gchar *templates = NULL;
+    gchar *error = NULL;
+    gint window = 256;
+    gint timeout_ms = 1000;
+    gint retries = 0;
+    gint64 start, elapsed;
+    gint asked = 0, n;
+    gint opt, i;
+
+    memset(&discovery, 0, sizeof(discovery));
+    discovery.port = 161;
+    discovery.vers = 2;
+    discovery.community = "public";
+
+    while ((opt = getopt(argc, argv, "p:v:c:w:t:r:f:")) != -1) {
+	switch (opt) {
+	case 'p': discovery.port = atoi(optarg); break;
+	case 'v': discovery.vers = atoi(optarg); break;
+	case 'c': discovery.community = optarg; break;
+	case 'w': window = atoi(optarg); break;
+	case 't': timeout_ms = atoi(optarg); break;
+	case 'r': retries = atoi(optarg); break;
+	case 'f': templates = optarg; break;
+	default: usage();
+	}
+    }
+    if (optind >= argc || discovery.port < 1 || discovery.vers < 1
+	    || discovery.vers > 2 || window < 1
+	    || window > DISCOVER_MAX_WINDOW || timeout_ms < 1 || retries < 0)
+	usage();
+
+    discovery.templates = g_ptr_array_new();
+    if (templates) {
+	if (!load_templates(discovery.templates, templates)) {
+	    fprintf(stderr, "discover_snmp: can't read %s\n", templates);
+	    return 1;
+	}
+    } else {
+	for (i = 0; i < G_N_ELEMENTS(default_templates); i++)
+	    add_template(discovery.templates, default_templates[i]);
+    }
+    discovery.labels = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, NULL);
+    discovery.classes = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+    discovery.class_order = g_ptr_array_new();
+
+    init_snmp("discover_snmp");
+
+    start = g_get_monotonic_time();
+    for (i = optind; i < argc; i++) {
+	n = discover_sweep(argv[i], discovery.port, discovery.vers,
+			   discovery.community, window,
+			   timeout_ms * (gint64)1000, retries,
+			   found, &discovery, &error);
+	if (n < 0) {
+	    fprintf(stderr, "discover_snmp: %s\n", error);
+	    g_free(error);
+	    return 1;
+	}
+	asked += n;
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    fprintf(stderr, "# %d addresses asked in %.1f s, %d agents, "
+	    "%d readers\n", asked, elapsed / (gdouble)G_USEC_PER_SEC,
+	    discovery.agents, discovery.readers);
+    for (i = 0; i < discovery.class_order->len; i++) {
+	fprintf(stderr, "#   %5d %s\n", GPOINTER_TO_INT(
+		g_hash_table_lookup(discovery.classes,
+			g_ptr_array_index(discovery.class_order, i))),
+		(gchar *)g_ptr_array_index(discovery.class_order, i));
+    }
+
+    return 0;
+}
@@ -0,0 +1,484 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+#include <string.h>
+#include <math.h>
+
+#include "expression.h"
+
+
+/* The operations, evaluated on a stack of doubles */
+
+enum {
+    OP_CONST,	/* push value */
+    OP_SAMPLE,	/* push a sample of ref (-1 is the reader itself) */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_ABS,
+    OP_MIN,
+    OP_MAX,
+    OP_END	/* pop the result of a series */
+};
+
+typedef struct {
+    gint op;
+    gdouble value;
+    gint ref;
+    gint what;
+    gint index;
+} ExprOp;
+
+struct Expr {
+    ExprOp *ops;
+    gint num_ops;
+    gint size;
+    gint depth, max_depth;
+    gint num_series;
+
+    /* readers referenced by label, resolved on first use */
+    gint num_refs;
+    gchar **ref_label;
+    gpointer *ref_source;
+
+    gdouble *stack;
+};
+
+typedef struct {
+    Expr *expr;
+    const gchar *s;
+    gchar *error;
+} ExprParser;
+
+
+static void
+emit(ExprParser *p, gint op)
+{
+    Expr *expr = p->expr;
+    ExprOp *o;
+
+    if (expr->num_ops == expr->size) {
+	expr->size = expr->size ? 2 * expr->size : 16;
+	expr->ops = g_renew(ExprOp, expr->ops, expr->size);
+    }
+    o = &expr->ops[expr->num_ops++];
+    memset(o, 0, sizeof(ExprOp));
+    o->op = op;
+
+    /* track the stack depth needed for evaluation */
+    switch (op) {
+    case OP_CONST:
+    case OP_SAMPLE:
+	if (++expr->depth > expr->max_depth)
+	    expr->max_depth = expr->depth;
+	break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MIN:
+    case OP_MAX:
+    case OP_END:
+	expr->depth--;
+	break;
+    }
+}
+
+static void
+parse_error(ExprParser *p, const gchar *what)
+{
+    if (!p->error)
+	p->error = g_strdup_printf("%s at \"%.10s\"", what, p->s);
+}
+
+static void
+skip_space(ExprParser *p)
+{
+    while (g_ascii_isspace(*p->s))
+	p->s++;
+}
+
+static gboolean
+accept(ExprParser *p, gchar c)
+{
+    skip_space(p);
+    if (*p->s != c)
+	return FALSE;
+    p->s++;
+    return TRUE;
+}
+
+static gboolean
+expect(ExprParser *p, gchar c)
+{
+    gchar what[] = "expected ' '";
+
+    if (accept(p, c))
+	return TRUE;
+    what[10] = c;
+    parse_error(p, what);
+    return FALSE;
+}
+
+static gint
+find_ref(Expr *expr, const gchar *label, gint len)
+{
+    gint i;
+
+    for (i = 0; i < expr->num_refs; i++)
+	if (strlen(expr->ref_label[i]) == len
+	    && !strncmp(expr->ref_label[i], label, len))
+	    return i;
+
+    expr->ref_label = g_renew(gchar *, expr->ref_label, i + 1);
+    expr->ref_label[i] = g_strndup(label, len);
+    expr->num_refs++;
+    return i;
+}
+
+/* [label]$n */
+static gboolean
+parse_sample(ExprParser *p, gint what)
+{
+    const gchar *label;
+    gint ref = -1;
+    ExprOp *o;
+
+    skip_space(p);
+    if (*p->s == '[') {
+	label = ++p->s;
+	while (*p->s && *p->s != ']')
+	    p->s++;
+	if (!*p->s || p->s == label) {
+	    parse_error(p, "bad reader label");
+	    return FALSE;
+	}
+	ref = find_ref(p->expr, label, p->s - label);
+	p->s++;
+    }
+    if (!expect(p, '$'))
+	return FALSE;
+    if (!g_ascii_isdigit(*p->s)) {
+	parse_error(p, "expected a sample number");
+	return FALSE;
+    }
+    emit(p, OP_SAMPLE);
+    o = &p->expr->ops[p->expr->num_ops - 1];
+    o->ref = ref;
+    o->what = what;
+    o->index = *p->s++ - '0';
+    return TRUE;
+}
+
+static gboolean parse_expression(ExprParser *p);
+
+static gboolean
+parse_primary(ExprParser *p)
+{
+    static const struct {
+	const gchar *name;
+	gint op;
+	gint args;
+    } functions[] = {
+	{ "rate", EXPR_RATE, 0 },
+	{ "delta", EXPR_DELTA, 0 },
+	{ "abs", OP_ABS, 1 },
+	{ "min", OP_MIN, 2 },
+	{ "max", OP_MAX, 2 },
+    };
+    const gchar *end;
+    gdouble value;
+    gint i, len;
+
+    skip_space(p);
+
+    if (*p->s == '(') {
+	p->s++;
+	return parse_expression(p) && expect(p, ')');
+    }
+
+    if (*p->s == '$' || *p->s == '[')
+	return parse_sample(p, EXPR_RAW);
+
+    if (g_ascii_isdigit(*p->s) || *p->s == '.') {
+	value = g_ascii_strtod(p->s, (gchar **)&end);
+	if (end == p->s) {
+	    parse_error(p, "bad number");
+	    return FALSE;
+	}
+	p->s = end;
+	emit(p, OP_CONST);
+	p->expr->ops[p->expr->num_ops - 1].value = value;
+	return TRUE;
+    }
+
+    for (len = 0; g_ascii_isalpha(p->s[len]); len++)
+	;
+    for (i = 0; i < G_N_ELEMENTS(functions); i++) {
+	if (strlen(functions[i].name) != len
+	    || strncmp(functions[i].name, p->s, len))
+	    continue;
+	p->s += len;
+	if (!expect(p, '('))
+	    return FALSE;
+	switch (functions[i].args) {
+	case 0:
+	    /* rate() and delta() apply to a sample only */
+	    if (!parse_sample(p, functions[i].op))
+		return FALSE;
+	    break;
+	case 1:
+	    if (!parse_expression(p))
+		return FALSE;
+	    emit(p, functions[i].op);
+	    break;
+	case 2:
+	    if (!parse_expression(p) || !expect(p, ',')
+		|| !parse_expression(p))
+		return FALSE;
+	    emit(p, functions[i].op);
+	    break;
+	}
+	return expect(p, ')');
+    }
+
+    parse_error(p, *p->s ? "unexpected input" : "unexpected end");
+    return FALSE;
+}
+
+static gboolean
+parse_unary(ExprParser *p)
+{
+    if (accept(p, '-')) {
+	if (!parse_unary(p))
+	    return FALSE;
+	emit(p, OP_NEG);
+	return TRUE;
+    }
+    return parse_primary(p);
+}
+
+static gboolean
+parse_term(ExprParser *p)
+{
+    gint op;
+
+    if (!parse_unary(p))
+	return FALSE;
+    for (;;) {
+	if (accept(p, '*'))
+	    op = OP_MUL;
+	else if (accept(p, '/'))
+	    op = OP_DIV;
+	else
+	    return TRUE;
+	if (!parse_unary(p))
+	    return FALSE;
+	emit(p, op);
+    }
+}
+
+static gboolean
+parse_expression(ExprParser *p)
+{
+    gint op;
+
+    if (!parse_term(p))
+	return FALSE;
+    for (;;) {
+	if (accept(p, '+'))
+	    op = OP_ADD;
+	else if (accept(p, '-'))
+	    op = OP_SUB;
+	else
+	    return TRUE;
+	if (!parse_term(p))
+	    return FALSE;
+	emit(p, op);
+    }
+}
+
+
+Expr *
+expr_compile(const gchar *text, gchar **error)
+{
+    ExprParser p;
+    Expr *expr;
+
+    expr = g_new0(Expr, 1);
+    p.expr = expr;
+    p.s = text;
+    p.error = NULL;
+
+    do {
+	if (expr->num_series == MAX_EXPR_SERIES) {
+	    parse_error(&p, "too many expressions");
+	    break;
+	}
+	if (!parse_expression(&p))
+	    break;
+	emit(&p, OP_END);
+	expr->num_series++;
+    } while (accept(&p, ';'));
+
+    skip_space(&p);
+    if (*p.s)
+	parse_error(&p, "unexpected input");
+
+    if (p.error) {
+	expr_free(expr);
+	if (error)
+	    *error = p.error;
+	else
+	    g_free(p.error);
+	return NULL;
+    }
+
+    expr->ref_source = g_new0(gpointer, expr->num_refs);
+    expr->stack = g_new(gdouble, expr->max_depth);
+    return expr;
+}
+
+gint
+expr_num_series(Expr *expr)
+{
+    return expr->num_series;
+}
+
+/* The labels of the other readers an expression refers to */
+gint
+expr_num_refs(Expr *expr)
+{
+    return expr->num_refs;
+}
+
+const gchar *
+expr_ref_label(Expr *expr, gint i)
+{
+    return expr->ref_label[i];
+}
+
+/*
+ * Evaluate all series into values[], NaN where undefined.  Labels are
+ * resolved through lookup() on first use and then cached, so an Expr must
+ * not outlive the sources it refers to.
+ */
+gboolean
+expr_eval(Expr *expr, gpointer self, ExprLookup lookup, ExprSample sample,
+	  gpointer data, gdouble *values, gchar **error)
+{
+    gdouble *sp = expr->stack;
+    gpointer source;
+    ExprOp *o, *end;
+
+    for (o = expr->ops, end = o + expr->num_ops; o < end; o++) {
+	switch (o->op) {
+	case OP_CONST:
+	    *sp++ = o->value;
+	    break;
+	case OP_SAMPLE:
+	    if (o->ref < 0)
+		source = self;
+	    else {
+		source = expr->ref_source[o->ref];
+		if (!source) {
+		    source = lookup(expr->ref_label[o->ref], data);
+		    if (!source) {
+			if (error)
+			    *error = g_strdup_printf("unknown reader [%s]",
+						  expr->ref_label[o->ref]);
+			return FALSE;
+		    }
+		    expr->ref_source[o->ref] = source;
+		}
+	    }
+	    if (!sample(source, o->what, o->index, sp))
+		*sp = NAN;
+	    sp++;
+	    break;
+	case OP_ADD:
+	    sp--;
+	    sp[-1] += sp[0];
+	    break;
+	case OP_SUB:
+	    sp--;
+	    sp[-1] -= sp[0];
+	    break;
+	case OP_MUL:
+	    sp--;
+	    sp[-1] *= sp[0];
+	    break;
+	case OP_DIV:
+	    sp--;
+	    sp[-1] = sp[0] != 0 ? sp[-1] / sp[0] : NAN;
+	    break;
+	case OP_NEG:
+	    sp[-1] = -sp[-1];
+	    break;
+	case OP_ABS:
+	    sp[-1] = fabs(sp[-1]);
+	    break;
+	case OP_MIN:
+	    sp--;
+	    if (sp[0] < sp[-1] || isnan(sp[0]))
+		sp[-1] = sp[0];
+	    break;
+	case OP_MAX:
+	    sp--;
+	    if (sp[0] > sp[-1] || isnan(sp[0]))
+		sp[-1] = sp[0];
+	    break;
+	case OP_END:
+	    *values++ = *--sp;
+	    break;
+	}
+    }
+    return TRUE;
+}
+
+void
+expr_free(Expr *expr)
+{
+    gint i;
+
+    if (!expr)
+	return;
+    for (i = 0; i < expr->num_refs; i++)
+	g_free(expr->ref_label[i]);
+    g_free(expr->ref_label);
+    g_free(expr->ref_source);
+    g_free(expr->ops);
+    g_free(expr->stack);
+    g_free(expr);
+}
@@ -0,0 +1,81 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+#include <glib.h>
+
+
+/*
+ * Derived series, computed from the samples of a reader and of other
+ * readers on the same agent.  An expression is compiled once into a flat
+ * array of operations in reverse polish notation, which is evaluated for
+ * each new sample without any parsing or allocation.
+ *
+ *   expressions := expression { ';' expression }
+ *   expression  := term { ( '+' | '-' ) term }
+ *   term        := unary { ( '*' | '/' ) unary }
+ *   unary       := '-' unary | primary
+ *   primary     := number | sample | '(' expression ')'
+ *                | 'rate' '(' sample ')' | 'delta' '(' sample ')'
+ *                | 'abs' '(' expression ')'
+ *                | ( 'min' | 'max' ) '(' expression ',' expression ')'
+ *   sample      := [ '[' label ']' ] '$' digit
+ *
+ * $n is the raw value of the n-th OID, [label]$n that of another reader.
+ * rate() is the change per second, delta() the change since the last
+ * sample.  Undefined results (a counter reset, division by zero) are NaN.
+ */
+
+#define MAX_EXPR_SERIES	10
+
+/* How a sample is requested from the caller */
+enum {
+    EXPR_RAW,
+    EXPR_DELTA,
+    EXPR_RATE
+};
+
+typedef struct Expr Expr;
+
+/* Find the source (e.g. a Reader) with the given label, NULL if unknown */
+typedef gpointer (*ExprLookup)(const gchar *label, gpointer data);
+/* Get a sample of a source, FALSE if there is no valid value */
+typedef gboolean (*ExprSample)(gpointer source, gint what, gint index,
+							gdouble *value);
+
+extern	Expr *expr_compile(const gchar *text, gchar **error);
+extern	gint expr_num_series(Expr *expr);
+extern	gint expr_num_refs(Expr *expr);
+extern	const gchar *expr_ref_label(Expr *expr, gint i);
+extern	gboolean expr_eval(Expr *expr, gpointer self,
+				ExprLookup lookup, ExprSample sample,
+				gpointer data, gdouble *values, gchar **error);
+extern	void expr_free(Expr *expr);
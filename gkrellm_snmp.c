@@ -32,10 +32,15 @@
 
 
 #include <stdio.h>
+#include <math.h>
 
 #include <gkrellm2/gkrellm.h>
 
 #include <simpleSNMP.h>
+#include <expression.h>
+#include <history.h>
+#include <samples.h>
+#include <publish.h>
 
 
 #define SNMP_PLUGIN_MAJOR_VERSION 1
@@ -46,8 +51,11 @@
 #define PLUGIN_CONFIG_NAME	"SNMP"
 /* The name of the configuration data in the user-config file */
 #define PLUGIN_CONFIG_KEYWORD	"snmp_monitor"
+/* The keyword for global options within the plugin's configuration data */
+#define PLUGIN_OPTION_KEYWORD	"snmp_option"
 /* The plugin specific style for theme subdir name and gkrellmrc */
 #define PLUGIN_STYLE_ID		"snmp"
+#define PLUGIN_METER_STYLE_ID	"snmp_meter"
 
 /* The parameters for the format based text display in the a chart */
 #define DEFAULT_FORMAT		"$L $0"
@@ -59,6 +67,13 @@
 #define	DEFAULT_VERS		1
 #define	DEFAULT_FREQ		100
 #define	DEFAULT_DIVISOR		1
+#define	DEFAULT_THREADS		1
+#define	DEFAULT_PIPELINE	1
+#define	DEFAULT_BACKGROUND	60	/* in seconds, 0 to pause */
+#define	DEFAULT_RATE		0	/* PDUs/s per agent, 0 for no limit */
+
+/* Older delta baselines from the history file are not taken up */
+#define	HISTORY_MAX_AGE		(10 * 60 * G_USEC_PER_SEC)
 
 /* The data structure for a chart */
 
@@ -70,38 +85,68 @@ struct Reader {
 	gchar			*peer;
 	gint			port;
 	gint			vers;
+	gint			transport;
 	gchar			*community;
 	gchar			*oid_base;
 	gchar			*oid_elements;
 	gchar			*oid_str[MAX_OID_STR];
+	gint			refresh[MAX_OID_STR];	/* in polls */
 	gint			num_oid_str;
 	gint			divisor;
 	gboolean		panel;
-	gint			delay;
+	gdouble			delay;		/* in GKrellM ticks */
 	gboolean		delta;
 	gchar			*formatString;  /* Format for chart labels */
 	gboolean		hideExtra;      /* True to hide extra info */
+	gchar			*expression;	/* derived series, may be empty */
+	Expr			*expr;
+	gint			meter;		/* full scale, 0 for a chart */
 
 	/* The sample data for a chart */
 	gint			new;
-	glong			sample_time;
-	glong			old_sample_time;
+	gulong			polls;		/* updates taken in */
+	gulong			deferred;	/* polls held back by the rate */
+	gint64			sample_time;	/* local monotonic usec */
+	gint64			old_sample_time;
+	gint64			uptime;		/* agent's TimeTicks, -1 if unknown */
 	gchar			*error;
 	gchar			*old_error;
-	gint			num_sample;
-	gint			asn1_type[MAX_FORMAT_VALUES];
-	gchar			*sample[MAX_FORMAT_VALUES];
-	glong			sample_n[MAX_FORMAT_VALUES];
-	glong			old_sample_n[MAX_FORMAT_VALUES];
+	gint			num_sample;	/* in the front set of new_data */
+	guint			gap;		/* mask of samples w/o delta */
+	guint			missing;	/* mask of samples w/o value */
+	/* the numbers are in the sample store, from this slot on */
+	gint			base;
+	gint			num_expr_value;
+	gdouble			expr_value[MAX_EXPR_SERIES];	/* NaN if gap */
+
+	/* The chart values and counters kept across restarts */
+	History			*history;
+	gint64			history_uptime;	/* of the agent, -1 if unknown */
+	/* The entry in shared memory, -1 if none */
+	gint			shm_slot;
 
 	/* The simpleSNMP interface information */
-	struct snmp_session	*session;
+	simple_session		*session;
 	struct input_data	new_data;
 
 	/* The gkrellm interface information */
 	GtkTooltips             *tooltip;
 	GkrellmChart		*chart;
 	GkrellmChartconfig	*chart_config;
+	/* or a meter, a single panel row with a krell and a text */
+	GkrellmPanel		*meter_panel;
+	GkrellmKrell		*krell;
+	GkrellmDecal		*decal;
+
+	/* What is on screen, to leave out redraws that would not change it */
+	gboolean		dirty;		/* redraw at the end of the tick */
+	gint			flat;		/* stores w/o a change in value */
+	gulong			shown[MAX_CHART_VALUES];
+	gchar			*shown_label;
+	gchar			*shown_tip;
+	/* Hidden readers poll at the background interval */
+	gboolean		visible;
+	gboolean		wanted;		/* shown, or used by one shown */
 };
 
  
@@ -109,23 +154,73 @@ static GkrellmMonitor *mon;
 static Reader *readers;
 static GtkWidget *main_vbox;
 static gint style_id;
-
-
+static gint meter_style_id;
+static gint num_threads = DEFAULT_THREADS;
+static gint pipeline_depth = DEFAULT_PIPELINE;
+static gint background = DEFAULT_BACKGROUND;
+static gdouble rate_limit = DEFAULT_RATE;
+/* the agents with a rate limit of their own, by "peer:port" */
+static GHashTable *agent_rates;
+static SampleStore *samples;
+static Publisher *publisher;	/* NULL if another GKrellM publishes */
+
+
+/* Format num into buf, which the label is rendered with every sample */
 static gchar *
-scale(glong num, gboolean scale_it)
+scale(gchar *buf, gsize size, gdouble num, gboolean scale_it)
 {
     if (scale_it) {
-	if (num > 2000000000)
-	    return g_strdup_printf("%ldG", num/1024/1024/1024);
-	if (num > 6000000)
-	    return g_strdup_printf("%ldM", num/1024/1024);
-	if (num > 6000)
-	    return g_strdup_printf("%ldK", num/1024);
+	if (num > 2000000000) {
+	    g_snprintf(buf, size, "%.0fG", num/1024/1024/1024);
+	    return buf;
+	}
+	if (num > 6000000) {
+	    g_snprintf(buf, size, "%.0fM", num/1024/1024);
+	    return buf;
+	}
+	if (num > 6000) {
+	    g_snprintf(buf, size, "%.0fK", num/1024);
+	    return buf;
+	}
     }
-    return g_strdup_printf("%ld", num);
+    /* fractions only matter for small rates */
+    if (num == (gint64)num || num >= 100 || num <= -100)
+	g_snprintf(buf, size, "%.0f", num);
+    else if (num >= 10 || num <= -10)
+	g_snprintf(buf, size, "%.1f", num);
+    else
+	g_snprintf(buf, size, "%.2f", num);
+    return buf;
 }
 
 
+/* The scheme of a reader's URL, e.g. snmp-v2c+tcp */
+static gchar *
+reader_scheme(Reader *reader)
+{
+    static gchar *scheme[3][2] = {
+	{ "snmp", "snmp+tcp" },
+	{ "snmp-v2c", "snmp-v2c+tcp" },
+	{ "snmp-v3", "snmp-v3+tcp" }
+    };
+
+    return scheme[CLAMP(reader->vers, 1, 3) - 1]
+		 [reader->transport == TRANSPORT_TCP];
+}
+
+/* The community as shown, without the passphrases of v3 */
+static gchar *
+reader_community(Reader *reader)
+{
+    static gchar user[CFG_BUFSIZE];
+
+    if (reader->vers != 3)
+	return reader->community;
+    g_strlcpy(user, reader->community, sizeof(user));
+    user[strcspn(user, ":")] = '\0';
+    return user;
+}
+
 static void
 render_error(Reader *reader)
 {
@@ -139,10 +234,10 @@ render_error(Reader *reader)
 		g_free(reader->old_error);
 		reader->old_error = reader->error;
 
-    message = g_strdup_printf ("%s (snmp%s://%s@%s:%d/%s[%s])\n%s",
+    message = g_strdup_printf ("%s (%s://%s@%s:%d/%s[%s])\n%s",
 			    reader->label,
-			    reader->vers == 2 ? "-v2c" : "",
-			    reader->community,
+			    reader_scheme(reader),
+			    reader_community(reader),
 			    reader->peer, reader->port,
 			    reader->oid_base,
 			    reader->oid_elements,
@@ -155,26 +250,155 @@ render_error(Reader *reader)
 }
 
 
-static glong
+static gdouble
+since_last (Reader *reader)
+{
+    /* local timestamps, in seconds */
+    return (reader->sample_time - reader->old_sample_time)
+					/ (gdouble)G_USEC_PER_SEC;
+}
+
+static gdouble
+since_last_n (Reader *reader, gint sample_num)
+{
+    gint s = reader->base + sample_num;
+
+    /* OIDs with a slower refresh have their own interval */
+    return (samples->time[s] - samples->prev_time[s]) / (gdouble)G_USEC_PER_SEC;
+}
+
+/*
+ * Find the samples that have no valid delta: the first one, all of them
+ * after the agent rebooted (its sysUpTime went backwards), and those whose
+ * counters were reset, as reported by the agent or seen going backwards.
+ */
+static guint
+find_gaps (Reader *reader, guint discontinuity, guint fresh, gboolean reboot)
+{
+    sample_set *set = INPUT_FRONT(&reader->new_data);
+    guint gap = 0;
+    gint i, s;
+
+    for (i = 0; i < reader->num_sample; i++) {
+	s = reader->base + i;
+	if (reboot || (discontinuity & (1 << i))) {
+	    gap |= 1 << i;
+	    /* a cached value is from before the reset, forget it */
+	    if (!(fresh & (1 << i)))
+		samples->time[s] = 0;
+	} else if (samples->prev_time[s] == 0)
+	    gap |= 1 << i;
+	else if (set->kind[i] == SAMPLE_COUNTER64
+		&& (guint64)samples->cur[s] < (guint64)samples->prev[s])
+	    gap |= 1 << i;
+	else if (set->kind[i] == SAMPLE_TIMETICKS
+		&& samples->cur[s] < samples->prev[s])
+	    gap |= 1 << i;
+    }
+    return gap;
+}
+
+static gboolean
+is_missing (Reader *reader, gint sample_num)
+{
+    /* the agent failed on the OID, it is left out until it's back */
+    return (reader->missing & (1 << sample_num)) != 0;
+}
+
+static gboolean
+is_gap (Reader *reader, gint sample_num)
+{
+    return (reader->gap & (1 << sample_num)) != 0;
+}
+
+/* The value as charted, computed for all readers by samples_compute() */
+static gdouble
 new_value (Reader *reader, gint sample_num)
 {
-    glong since_last = 0;
-    glong val;
+    if (is_missing (reader, sample_num))
+	return 0;
+    if (reader->delta && is_gap (reader, sample_num))
+	return 0;
+    return samples->value[reader->base + sample_num];
+}
 
-    /* 100: turn TimeTicks into seconds */
-    since_last = (reader->sample_time - reader->old_sample_time) / 100;
-
-//AG Multi: What needs to be different for each sample_num?
-    if (reader->delta && reader->divisor == 0)
-	val = (reader->sample_n[sample_num] - reader->old_sample_n[sample_num]);
-    else if (reader->delta)
-	val = (reader->sample_n[sample_num] - reader->old_sample_n[sample_num]) /
-		( (since_last < 1) ? 1 : since_last ) / reader->divisor;
+/* How the sample store computes the value of a reader's samples */
+static void
+setup_samples (Reader *reader)
+{
+    gint divisor = reader->divisor;
+
+    if (!reader->delta)
+	samples_setup(samples, reader->base,
+		      1.0 / (divisor == 0 ? 1 : divisor), 0, 0);
+    else if (divisor == 0)
+	samples_setup(samples, reader->base, 0, 1, 0);
     else
-	val = reader->sample_n[sample_num] / 
-		( (reader->divisor == 0) ? 1 : reader->divisor );
+	samples_setup(samples, reader->base, 0, 0, 1.0 / divisor);
+}
+
+static gulong
+chart_value (gdouble val)
+{
+    /* the chart only knows about non-negative integers */
+    return (val <= 0 || isnan(val)) ? 0 : (gulong)(val + 0.5);
+}
+
+
+/*
+ * Expressions may refer to other readers of the same agent by label,
+ * their latest samples are used as they are, nothing is fetched for it.
+ */
+static gpointer
+expr_lookup (const gchar *label, gpointer data)
+{
+    Reader *self = (Reader *)data;
+    Reader *reader;
+
+    for (reader = readers; reader; reader = reader->next) {
+	if (!strcmp(reader->label, label)
+	    && !strcmp(reader->peer, self->peer) && reader->port == self->port)
+	    return reader;
+    }
+    return NULL;
+}
 
-    return val;
+static gboolean
+expr_sample (gpointer source, gint what, gint index, gdouble *value)
+{
+    Reader *reader = (Reader *)source;
+    gint s = reader->base + index;
+
+    if (index >= reader->num_sample || is_missing (reader, index))
+	return FALSE;
+    if (what == EXPR_RAW) {
+	*value = (gdouble)samples->cur[s];
+	return TRUE;
+    }
+    if (is_gap (reader, index))
+	return FALSE;
+    if (what == EXPR_DELTA) {
+	*value = samples->delta[s];
+	return TRUE;
+    }
+    if (since_last_n (reader, index) <= 0)
+	return FALSE;
+    *value = samples->rate[s];
+    return TRUE;
+}
+
+static void
+eval_expression (Reader *reader)
+{
+    if (!reader->expr)
+	return;
+    if (expr_eval(reader->expr, reader, expr_lookup, expr_sample, reader,
+		  reader->expr_value, &reader->error)) {
+	reader->num_expr_value = expr_num_series(reader->expr);
+    } else {
+	reader->num_expr_value = 0;
+	render_error(reader);
+    }
 }
 
 
@@ -189,7 +413,8 @@ render_label(Reader *reader)
     gint index;
     gint len;
     gboolean scale_it;
-    glong value;
+    gdouble value;
+    gchar num_buf[64];
     gchar buffer[128];
     gchar *buf = buffer;
     gint size = sizeof (buffer);
@@ -220,12 +445,26 @@ render_label(Reader *reader)
 		/* Note, we ignore the scale argument */
 		len = snprintf(buf, size, "%s", reader->label);
 	    } else if (c == 'M') {
-		index = gkrellm_get_chart_scalemax(reader->chart);
-		len = snprintf(buf, size, "%s", scale(index, scale_it));
+		index = reader->chart ? gkrellm_get_chart_scalemax(reader->chart)
+				      : reader->meter;
+		len = snprintf(buf, size, "%s",
+			       scale(num_buf, sizeof(num_buf), index, scale_it));
 	    } else if (c == 'I') {
 		len = snprintf(buf, size, "%ss", 
-		   scale((reader->sample_time - reader->old_sample_time + 50)/100,
-		   scale_it));
+		   scale(num_buf, sizeof(num_buf), since_last (reader),
+			 scale_it));
+	    } else if (c == 'X' && isdigit(s[2])) {
+		/* $X0 up to $X9, the derived series */
+		index = s[2] - '0';
+		if (index >= reader->num_expr_value)
+		    len = 0;
+		else if (isnan(reader->expr_value[index]))
+		    len = snprintf(buf, size, "-");
+		else
+		    len = snprintf(buf, size, "%s",
+			    scale(num_buf, sizeof(num_buf),
+				  reader->expr_value[index], scale_it));
+		++s;
 	    } else {
 		index = -1;
 		if (isdigit(c))
@@ -235,9 +474,13 @@ render_label(Reader *reader)
 		if (index >= 0  &&  index < MAX_FORMAT_VALUES) {
 		    if (index >= reader->num_sample) {
 			len = 0;
+		    } else if (is_missing (reader, index)
+				|| (reader->delta && is_gap (reader, index))) {
+			len = snprintf(buf, size, "-");
 		    } else {
 			value = new_value (reader, index);
-			len = snprintf(buf, size, "%s", scale(value, scale_it));
+			len = snprintf(buf, size, "%s", scale(num_buf,
+					sizeof(num_buf), value, scale_it));
 		    }
 		}
 		else {
@@ -264,59 +507,80 @@ render_label(Reader *reader)
 static gchar *
 render_info(Reader *reader)
 {
-    glong since_last = 0;
-    glong val;
+    gdouble interval;
+    gdouble val;
+    gint64 uptime;
     gint up_d, up_h, up_m;
     gint i;
     gchar time_buf [100];
     gchar divisor_buf [100];
     gchar *temp_buf;
     gchar *sample_buf;
+    gchar throttle_buf [100];
     
-    /* 100: turn TimeTicks into seconds */
-    since_last = (reader->sample_time - reader->old_sample_time) / 100;
+    interval = since_last (reader);
+    uptime = MAX(reader->uptime, 0);
 
-    up_d = reader->sample_time/100/60/60/24;
-    up_h = (reader->sample_time/100/60/60) % 24;
-    up_m = (reader->sample_time/100/60) % 60;
+    /* 100: turn TimeTicks into seconds */
+    up_d = uptime/100/60/60/24;
+    up_h = (uptime/100/60/60) % 24;
+    up_m = (uptime/100/60) % 60;
 
 
     if (reader->delta && reader->divisor != 0) {
-	sprintf (time_buf, "/ %lds", since_last);
+	sprintf (time_buf, "/ %.3gs", interval);
     } else {
-	sprintf (time_buf, "[%lds]", since_last);
+	sprintf (time_buf, "[%.3gs]", interval);
     }
     if (reader->divisor > 1) {
 	sprintf (divisor_buf, "/ %d ", reader->divisor);
     } else {
 	divisor_buf[0] = '\0';
     }
+    /* the share of polls the agent's rate limit held back */
+    if (reader->deferred > 0) {
+	sprintf (throttle_buf, " Throttled: %.0f%%", 100.0 * reader->deferred
+				/ (reader->polls + reader->deferred));
+    } else {
+	throttle_buf[0] = '\0';
+    }
 
     sample_buf = g_strdup ("");
     for (i = 0; i < reader->num_sample; i++) {
 	val = new_value (reader, i);
-	temp_buf = g_strdup_printf ("%s\n '%s' %ld%s%ld%s %s %s-> %ld", sample_buf,
-			reader->sample[i],
-			reader->sample_n[i],
+	temp_buf = g_strdup_printf ("%s\n '%s' %" G_GINT64_FORMAT "%s%"
+			G_GINT64_FORMAT "%s %s %s-> %.6g%s", sample_buf,
+			INPUT_FRONT(&reader->new_data)->sample[i],
+			samples->cur[reader->base + i],
 			reader->delta ? "-" : "[",
-			reader->old_sample_n[i],
+			samples->prev[reader->base + i],
 			reader->delta ? "" : "]",
 			time_buf,
 			divisor_buf,
-			val);
+			val,
+			is_missing (reader, i) ? " (missing, rechecked later)" :
+			reader->delta && is_gap (reader, i) ? " (gap)" : "");
+	g_free (sample_buf);
+	sample_buf = temp_buf;
+	temp_buf = NULL;
+    }
+    for (i = 0; i < reader->num_expr_value; i++) {
+	temp_buf = g_strdup_printf ("%s\n X%d -> %.6g", sample_buf, i,
+				    reader->expr_value[i]);
 	g_free (sample_buf);
 	sample_buf = temp_buf;
 	temp_buf = NULL;
     }
 
-    return g_strdup_printf("%s: (snmp%s://%s@%s:%d/%s[%s]) Uptime: %dd %d:%d%s",
+    return g_strdup_printf("%s: (%s://%s@%s:%d/%s[%s]) Uptime: %dd %d:%d%s%s",
 			reader->label,
-			reader->vers == 2 ? "-v2c" : "",
-			reader->community,
+			reader_scheme(reader),
+			reader_community(reader),
 			reader->peer, reader->port,
 			reader->oid_base,
 			reader->oid_elements,
 			up_d, up_h, up_m,
+			throttle_buf,
 			sample_buf);
 }
 
@@ -340,6 +604,169 @@ cb_draw_chart(gpointer data)
 
 	if (reader->chart->panel) gkrellm_draw_panel_label(reader->chart->panel);
 	gkrellm_draw_chart_to_screen(reader->chart);
+	reader->dirty = FALSE;
+}
+
+static void
+draw_meter(Reader *reader)
+{
+	gchar *text;
+
+	text = reader->hideExtra ? g_strdup(reader->label)
+				 : render_label(reader);
+	gkrellm_draw_decal_text(reader->meter_panel, reader->decal, text, -1);
+	g_free(text);
+	gkrellm_update_krell(reader->meter_panel, reader->krell,
+						reader->shown[0]);
+	gkrellm_draw_panel_layers(reader->meter_panel);
+	reader->dirty = FALSE;
+}
+
+/*
+ * A stored value scrolls the chart, but once the chart is as wide as
+ * the run of equal values, the scrolled picture is the same as before.
+ * Only if it differs, or the label does, the reader is marked dirty.
+ * A meter only changes with its first value.
+ */
+static void
+mark_dirty(Reader *reader, gulong *val, gboolean stored)
+{
+	gchar *text;
+
+	if (stored && reader->meter_panel) {
+	    if (reader->shown[0] != val[0]) {
+		reader->shown[0] = val[0];
+		reader->dirty = TRUE;
+	    }
+	} else if (stored) {
+	    if (memcmp(reader->shown, val, sizeof(reader->shown)) == 0) {
+		if (reader->flat < reader->chart->w)
+		    reader->flat++;
+	    } else {
+		memcpy(reader->shown, val, sizeof(reader->shown));
+		reader->flat = 0;
+	    }
+	    if (reader->flat < reader->chart->w)
+		reader->dirty = TRUE;
+	}
+
+	if (!reader->hideExtra) {
+	    text = render_label(reader);
+	    if (reader->shown_label && !strcmp(reader->shown_label, text)) {
+		g_free(text);
+	    } else {
+		g_free(reader->shown_label);
+		reader->shown_label = text;
+		reader->dirty = TRUE;
+	    }
+	}
+
+	if (!reader->chart)
+	    return;
+	text = render_info(reader);
+	if (reader->shown_tip && !strcmp(reader->shown_tip, text)) {
+	    g_free(text);
+	} else {
+	    g_free(reader->shown_tip);
+	    reader->shown_tip = text;
+	    gtk_tooltips_set_tip(reader->tooltip,
+				 reader->chart->drawing_area, text, "");
+	    gtk_tooltips_enable(reader->tooltip);
+	}
+}
+
+/* Poll intervals in usec, the one configured and the one while hidden */
+static gint64
+poll_interval(Reader *reader)
+{
+	return (gint64)(reader->delay * G_USEC_PER_SEC / gkrellm_update_HZ());
+}
+
+static gint64
+background_interval(Reader *reader)
+{
+	if (background == 0)
+		return PAUSE_INTERVAL;
+	return MAX((gint64)background * G_USEC_PER_SEC, poll_interval(reader));
+}
+
+/* Whether anything on the chart shows the values of the reader */
+static gboolean
+chart_shown(Reader *reader)
+{
+	GList *list;
+
+	if (reader->meter_panel)
+		return gkrellm_is_panel_visible(reader->meter_panel);
+	if (!gkrellm_is_chart_visible(reader->chart))
+		return FALSE;
+	if (!reader->hideExtra)
+		return TRUE;
+	for (list = gkrellm_get_chartdata_list(reader->chart); list;
+							list = list->next)
+		if (!gkrellm_get_chartdata_hide(list->data))
+			return TRUE;
+	return FALSE;
+}
+
+/*
+ * Readers nobody looks at, on a hidden chart or an iconified GKrellM,
+ * drop to the background interval and are back at full rate as soon as
+ * they are shown.  Readers that expressions of shown ones refer to are
+ * kept at full rate.
+ */
+static void
+update_visibility(void)
+{
+	Reader *reader, *ref;
+	GtkWidget *top;
+	gboolean iconified = FALSE;
+	gint i;
+
+	top = gkrellm_get_top_window();
+	if (top && top->window)
+		iconified = (gdk_window_get_state(top->window)
+				& (GDK_WINDOW_STATE_ICONIFIED
+					| GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+
+	for (reader = readers; reader ; reader = reader->next)
+		reader->wanted = (reader->chart || reader->meter_panel)
+					&& !iconified && chart_shown(reader);
+	for (reader = readers; reader ; reader = reader->next) {
+		if (!reader->wanted || !reader->expr)
+			continue;
+		for (i = 0; i < expr_num_refs(reader->expr); i++) {
+			ref = expr_lookup(expr_ref_label(reader->expr, i),
+								reader);
+			if (ref)
+				ref->wanted = TRUE;
+		}
+	}
+
+	for (reader = readers; reader ; reader = reader->next) {
+		if (!reader->session || reader->wanted == reader->visible)
+			continue;
+		reader->visible = reader->wanted;
+		simpleSNMPset_interval(reader->session, reader->visible
+						? poll_interval(reader)
+						: background_interval(reader));
+	}
+}
+
+/* Draw the charts and meters that changed during this tick, each once */
+static void
+flush_charts(void)
+{
+	Reader *reader;
+
+	for (reader = readers; reader ; reader = reader->next) {
+	    if (!reader->dirty)
+		continue;
+	    if (reader->chart)
+		cb_draw_chart(reader);
+	    else if (reader->meter_panel)
+		draw_meter(reader);
+	}
 }
 
 static void
@@ -363,36 +790,171 @@ cb_panel_click(GtkWidget *widget, GdkEventButton *event, gpointer data)
             gkrellm_open_config_window(mon);
 }
 
+static void
+cb_meter_click(GtkWidget *widget, GdkEventButton *event, gpointer data)
+{
+	Reader *reader = (Reader *)data;
+
+	if (event->button == 1) {
+	    reader->hideExtra = !reader->hideExtra;
+	    draw_meter(reader);
+	    gkrellm_config_modified();
+	} else if (event->button == 3) {
+	    gkrellm_open_config_window(mon);
+	}
+}
+
 
 /* GKrellM interface */
 
+/* A file name from the label, valid on its own */
+static gchar *
+history_label(Reader *reader)
+{
+    return g_strdelimit(g_strdup(reader->label), "/ \t", '_');
+}
+
+/*
+ * The ring file of a reader.  Labels need not be unique, so a reader
+ * sharing one with readers before it gets their number after it.
+ */
+static gchar *
+history_name(Reader *reader)
+{
+    Reader *other;
+    gchar *label, *name;
+    gint dup = 0;
+
+    label = history_label(reader);
+    for (other = readers; other && other != reader; other = other->next) {
+	name = history_label(other);
+	if (!strcmp(name, label))
+	    dup++;
+	g_free(name);
+    }
+    name = dup ? g_strdup_printf("%s.%d.ring", label, dup + 1)
+	       : g_strdup_printf("%s.ring", label);
+    g_free(label);
+    return name;
+}
+
+/*
+ * Map the history file of a reader and take up where it left off: the
+ * chart gets its recent values back and the counters their baseline, so
+ * the first delta after a restart is as good as any other.
+ */
+static void
+open_history(Reader *reader)
+{
+    HistoryCounter *counter;
+    gulong val[MAX_CHART_VALUES];
+    gchar *name, *path, *setup;
+    gint64 now, offset;
+    gint i, n;
+
+    reader->history_uptime = -1;
+
+    /* a change of the setup starts over */
+    name = history_name(reader);
+    path = gkrellm_make_data_file_name("snmp", name);
+    setup = g_strdup_printf("%s:%d/%s[%s] %d %d %s",
+			    reader->peer, reader->port,
+			    reader->oid_base, reader->oid_elements,
+			    reader->delta, reader->divisor,
+			    reader->expression ? reader->expression : "");
+    reader->history = history_open(path, g_str_hash(setup),
+				   MAX_CHART_VALUES, MAX_OID_STR + 1);
+    g_free(name);
+    g_free(path);
+    g_free(setup);
+    if (!reader->history)
+	return;
+
+    n = history_length(reader->history);
+    for (i = 0; i < n; i++) {
+	history_get(reader->history, i, val);
+	gkrellm_store_chartdata(reader->chart, 0, val[0], val[1], val[2]);
+    }
+
+    /* the counters were saved in wall clock time */
+    now = g_get_real_time();
+    offset = g_get_monotonic_time() - now;
+    counter = history_counters(reader->history);
+    for (i = 0; i < MAX_OID_STR; i++) {
+	if (counter[i].time == 0 || now - counter[i].time > HISTORY_MAX_AGE)
+	    continue;
+	samples->cur[reader->base + i] = counter[i].value;
+	samples->time[reader->base + i] = counter[i].time + offset;
+    }
+    /* the agent's sysUpTime comes last, to tell a restart meanwhile */
+    if (counter[MAX_OID_STR].time != 0)
+	reader->history_uptime = counter[MAX_OID_STR].value;
+}
+
+/* Keep the counters just fetched as the baseline after a restart */
+static void
+save_history(Reader *reader, guint fresh)
+{
+    HistoryCounter *counter;
+    gint64 offset;
+    gint i;
+
+    if (!reader->history)
+	return;
+    offset = g_get_real_time() - g_get_monotonic_time();
+    counter = history_counters(reader->history);
+    for (i = 0; i < reader->num_sample; i++) {
+	if (!(fresh & (1 << i)))
+	    continue;
+	counter[i].value = samples->cur[reader->base + i];
+	counter[i].time = samples->time[reader->base + i] + offset;
+    }
+    if (reader->uptime >= 0) {
+	counter[MAX_OID_STR].value = reader->uptime;
+	counter[MAX_OID_STR].time = reader->sample_time + offset;
+    }
+}
+
 static void
 update_plugin()
 {
     Reader *reader;
-    gchar  *text = NULL;
     gint i;
-    glong val[MAX_CHART_VALUES];
+    sample_set *set;
+    gulong val[MAX_CHART_VALUES];
+    gboolean gap, reboot;
 
-    /* See if we received SNMP responses */
+    /* Collect the SNMP responses decoded by the worker thread */
     simpleSNMPupdate();
 
-    /* Send new SNMP requests */
+    /* Open new sessions and take over their data */
     for (reader = readers; reader ; reader = reader->next)
     {
+	/* the chart or meter and the sample slots come with create_reader() */
+	if (reader->chart == NULL && reader->meter_panel == NULL)
+	    continue;
+
 	if (! reader->session) {
+	    /* Open errors are reported asynchronously through new_data */
 	    reader->session = simpleSNMPopen(reader->peer,
 					     reader->port,
 					     reader->vers,
 					     reader->community,
+					     reader->transport,
 					     &reader->new_data);
-	    if (! reader->session) {
+	    reader->new_data.new = 0;
+	    reader->new = 0;
+
+	    /* From now on the SNMP worker schedules the requests */
+	    reader->visible = TRUE;
+	    if (!simpleSNMPpoll(reader->session, reader->oid_str,
+				reader->refresh, reader->num_oid_str,
+				poll_interval(reader))) {
 		reader->error = reader->new_data.error;
 		reader->new_data.error = NULL;
+		reader->new_data.new = 0;
 		render_error(reader);
 	    }
-	    reader->new_data.new = 0;
-	    reader->new = 0;
 	}
 
 	/* Update new data, if available */
@@ -402,56 +964,97 @@ update_plugin()
 		reader->new_data.error = NULL;
 		render_error(reader);
 	    } else {
+		/* take over the latest poll, the strings stay in its set */
+		simpleSNMPswap(&reader->new_data);
+		set = INPUT_FRONT(&reader->new_data);
 		reader->old_sample_time = reader->sample_time;
-		reader->sample_time = reader->new_data.sample_n[0];
-		reader->num_sample = reader->new_data.num_sample - 1;
+		reader->sample_time = set->timestamp;
+		/* the agent's timebase, shared by all its readers */
+		reader->uptime = set->uptime;
+		reader->num_sample = set->num_sample;
+		reader->missing = set->missing;
 		for (i = 0; i < reader->num_sample; i++) {
-		    reader->asn1_type[i] = reader->new_data.asn1_type[i + 1];
-		    if (reader->sample[i]) g_free(reader->sample[i]);
-		    reader->sample[i] = reader->new_data.sample[i + 1];
-		    reader->new_data.sample[i + 1] = NULL;
-		    reader->old_sample_n[i] = reader->sample_n[i];
-		    reader->sample_n[i] = reader->new_data.sample_n[i + 1];
+		    /* cached values keep the delta of their last fetch */
+		    if (!(set->fresh & (1 << i)))
+			continue;
+		    samples_push(samples, reader->base + i,
+				 set->sample_n[i],
+				 set->sample_time[i],
+				 set->kind[i] == SAMPLE_COUNTER32);
 		}
+		/* the agent may have restarted while GKrellM didn't run */
+		reboot = set->reboot;
+		if (reader->history_uptime >= 0 && reader->uptime >= 0
+			&& reader->uptime < reader->history_uptime)
+		    reboot = TRUE;
+		reader->history_uptime = -1;
+		reader->gap = find_gaps (reader,
+					 set->discontinuity,
+					 set->fresh,
+					 reboot);
+		save_history (reader, set->fresh);
+		reader->polls++;
+		reader->deferred += set->deferred;
 		reader->new = 1;
 	    }
 	    reader->new_data.new = 0;
 	}
+    }
 
-	/* Send new SNMP requests */
-	if ( (reader->session) && ((GK.timer_ticks % reader->delay) == 0)) {
-	    if (!simpleSNMPsend(reader->session, reader->oid_str, 
-							reader->num_oid_str)) {
-		reader->error = reader->new_data.error;
-		reader->new_data.error = NULL;
-		reader->new_data.new = 0;
-		render_error(reader);
-	    }
-	}
+    /* The rates and values of all readers in one pass */
+    samples_compute(samples);
 
+    for (reader = readers; reader ; reader = reader->next)
+    {
 	/* Note, we may get the data delayed by one or more grkrell interval's */
 	if (reader->session && reader->new != 0) {
-	    if (reader->chart != NULL)
+	    /* after all readers are updated, expressions may refer to them */
+	    eval_expression (reader);
+	    publish_sample(publisher, reader->shm_slot, reader->num_sample,
+			   &samples->cur[reader->base],
+			   &samples->delta[reader->base],
+			   &samples->rate[reader->base],
+			   reader->sample_time, reader->gap, reader->missing,
+			   reader->uptime);
+	    if (reader->chart != NULL || reader->meter_panel != NULL)
 	    {
 		for (i = 0; i < MAX_CHART_VALUES; i++) {
 		    val[i] = 0;
 		}
-		for (i = 0; i < MAX_CHART_VALUES && i < reader->num_sample; i++) {
-		    val[i] = new_value (reader, i);
+		/*
+		 * A chart has no notion of missing values, so rather skip
+		 * the whole sample than draw a spike from a counter reset.
+		 */
+		gap = FALSE;
+		if (reader->expr) {
+		    /* Derived series replace the samples on the chart */
+		    for (i = 0; i < MAX_CHART_VALUES && i < reader->num_expr_value; i++) {
+			val[i] = chart_value (reader->expr_value[i]);
+			if (isnan(reader->expr_value[i]))
+			    gap = TRUE;
+		    }
+		} else {
+		    for (i = 0; i < MAX_CHART_VALUES && i < reader->num_sample; i++) {
+			val[i] = chart_value (new_value (reader, i));
+			if (reader->delta && is_gap (reader, i))
+			    gap = TRUE;
+		    }
 		}
 		/* Note, the number of val[] must be exactly MAX_CHART_VALUES */
-		gkrellm_store_chartdata(reader->chart, 0, val[0], val[1], val[2]);
-		cb_draw_chart(reader);
-
-		text = render_info(reader);
-		gtk_tooltips_set_tip(reader->tooltip, 
-					reader->chart->drawing_area, text, "");
-		gtk_tooltips_enable(reader->tooltip);
-		g_free(text);
+		if (!gap && reader->chart) {
+		    gkrellm_store_chartdata(reader->chart, 0, val[0], val[1], val[2]);
+		    if (reader->history)
+			history_append(reader->history, g_get_real_time(), val);
+		}
+		mark_dirty(reader, val, !gap);
 	    }
 	    reader->new = 0;
 	}
     }
+
+    flush_charts();
+    update_visibility();
+    publish_tick(publisher);
 }
 
 static gint
@@ -532,10 +1135,62 @@ create_chart(GtkWidget *vbox, Reader *reader, gint first_create)
 }
 
 
+/*
+ * A meter is a lot lighter than a chart: one panel row, no chart data,
+ * no history and no tooltip.  The krell shows the first value, the text
+ * the Format.
+ */
+static void
+create_meter(GtkWidget *vbox, Reader *reader, gint first_create)
+{
+    GkrellmStyle *style;
+
+    if (first_create) {
+	reader->meter_panel = gkrellm_panel_new0();
+    } else {
+	gkrellm_destroy_krell_list(reader->meter_panel);
+	gkrellm_destroy_decal_list(reader->meter_panel);
+    }
+
+    style = gkrellm_meter_style(meter_style_id);
+    reader->decal = gkrellm_create_decal_text(reader->meter_panel, "Ay0",
+				gkrellm_meter_textstyle(meter_style_id),
+				style, -1, -1, -1);
+    reader->krell = gkrellm_create_krell(reader->meter_panel,
+				gkrellm_krell_meter_piximage(meter_style_id),
+				style);
+    gkrellm_monotonic_krell_values(reader->krell, FALSE);
+    gkrellm_set_krell_full_scale(reader->krell, reader->meter, 1);
+
+    gkrellm_panel_configure(reader->meter_panel, NULL, style);
+    gkrellm_panel_create(vbox, mon, reader->meter_panel);
+
+    if (first_create) {
+	gtk_signal_connect(GTK_OBJECT(reader->meter_panel->drawing_area),
+			"expose_event", (GtkSignalFunc) chart_expose_event,
+			reader->meter_panel->pixmap);
+	gtk_signal_connect(GTK_OBJECT(reader->meter_panel->drawing_area),
+			"button_press_event", (GtkSignalFunc) cb_meter_click,
+			reader);
+    }
+    draw_meter(reader);
+}
+
 static void
 create_reader(GtkWidget *vbox, Reader *reader, gint first_create)
 {
-	create_chart(vbox, reader, first_create);
+	if (reader->meter > 0)
+		create_meter(vbox, reader, first_create);
+	else
+		create_chart(vbox, reader, first_create);
+	if (first_create) {
+		reader->base = samples_alloc(samples);
+		setup_samples(reader);
+		reader->shm_slot = publish_slot(publisher, reader->label,
+						reader->peer, reader->port);
+		if (reader->chart)
+			open_history(reader);
+	}
 }
 
 static void
@@ -555,25 +1210,28 @@ destroy_reader(Reader *reader)
 	    g_free(reader->oid_str[i]);
 	}
 	g_free(reader->formatString);
+	g_free(reader->expression);
+	expr_free(reader->expr);
+	g_free(reader->shown_label);
+	g_free(reader->shown_tip);
 
-	for (i = 0; i < reader->num_sample; i++) {
-	    g_free(reader->sample[i]);
-	}
-
-	if (reader->session)
-		simpleSNMPclose(reader->session);
-	/* can't free snmp session. may be there are pending snmp_reads! */
-	/*
+	/* The worker frees the session, once pending responses are drained */
 	if (reader->session)
 		simpleSNMPclose(reader->session);
-	g_free(reader->session);
-	*/
+	history_close(reader->history);
+	simpleSNMPfree_data(&reader->new_data);
   
 	if (reader->chart)
 	{
 		gkrellm_chartconfig_destroy(&reader->chart_config);
 		gkrellm_chart_destroy(reader->chart);
 	}
+	if (reader->meter_panel)
+		gkrellm_panel_destroy(reader->meter_panel);
+	if (reader->chart || reader->meter_panel) {
+		samples_free(samples, reader->base);
+		publish_release(publisher, reader->shm_slot);
+	}
 
 	g_free(reader);
 }
@@ -590,6 +1248,26 @@ create_plugin(GtkWidget *vbox, gint first_create)
 	}
 }
 
+/*
+ * An OID may end in a refresh class: @N fetches it with every N-th poll
+ * only, @static once (until the agent reboots or resets its counters).
+ */
+static void
+parse_refresh (Reader *reader, gint i)
+{
+	gchar *class;
+
+	reader->refresh[i] = 1;
+	class = strrchr (reader->oid_str[i], '@');
+	if (class == NULL)
+	    return;
+	*class++ = '\0';
+	if (!strcmp (class, "static"))
+	    reader->refresh[i] = REFRESH_STATIC;
+	else if (atoi (class) > 1)
+	    reader->refresh[i] = atoi (class);
+}
+
 static void
 prepare_oid_str (Reader *reader)
 {
@@ -598,15 +1276,14 @@ prepare_oid_str (Reader *reader)
 	gchar *element;
 	gint i;
 
-	/* The first oid_str is for system up time */
-	gkrellm_dup_string(&reader->oid_str[0], "system.sysUpTime.0");
+	/* Note, sysUpTime is fetched by simpleSNMP once per agent */
 
 	/* Check if there is a marker in the base */
 //AG String Functions: don't know about glib or gkrellm functions for this
 	if (strstr (reader->oid_base, "%s") == NULL ||
 					strlen (reader->oid_elements) == 0) {
-	    gkrellm_dup_string(&reader->oid_str[1], reader->oid_base);
-	    reader->num_oid_str = 2;
+	    gkrellm_dup_string(&reader->oid_str[0], reader->oid_base);
+	    reader->num_oid_str = 1;
 	} else {
 	    /* Insert each element into the base */
 	    elements = g_strdup (reader->oid_elements);
@@ -614,7 +1291,7 @@ prepare_oid_str (Reader *reader)
 	    for (i = 0; i < MAX_FORMAT_VALUES; i++) {
 //AG String Functions: don't know about glib or gkrellm functions for this
 		element = strsep (&elementp, ",");
-		reader->oid_str[1 + i] = 
+		reader->oid_str[i] = 
 				g_strdup_printf (reader->oid_base, element);
 		if (elementp == NULL) {
 		    i++;
@@ -622,10 +1299,11 @@ prepare_oid_str (Reader *reader)
 		}
 	    }
 	    g_free (elements);
-	    reader->num_oid_str = 1 + i;
+	    reader->num_oid_str = i;
 	}
 
 	for (i = 0; i < reader->num_oid_str; i++) {
+	    parse_refresh (reader, i);
 	    if (!simpleSNMPcheck_oid(reader->oid_str[i])) {
 		reader->error = g_strdup_printf("Error parsing oid: %s", 
 							reader->oid_str[i]);
@@ -635,17 +1313,31 @@ prepare_oid_str (Reader *reader)
 	}
 }
 
+static void
+prepare_expression (Reader *reader)
+{
+	expr_free(reader->expr);
+	reader->expr = NULL;
+	reader->num_expr_value = 0;
+
+	if (!reader->expression || !*reader->expression)
+	    return;
+	reader->expr = expr_compile(reader->expression, &reader->error);
+	if (!reader->expr)
+	    render_error (reader);
+}
+
 /* Config section */
 
-#define CLIST_WIDTH 13
+#define CLIST_WIDTH 16
 
 /* This list represents the internal order and elements of each config table, */
 /* it is used for the definition of reader_clist in create_plugin_tab() below */
 static gchar *reader_title[CLIST_WIDTH] =
-{ "Label", "Peer", "Port", "V",
+{ "Label", "Peer", "Port", "V", "TCP",
   "Community", "OID", "Elements",
   "Freq", "Format", "Divisor", 
-  "Hide", "Delta", "Panel" };
+  "Hide", "Delta", "Panel", "Meter", "Expressions" };
 
 /* The global elements underlying the configuration table */
 /* They are mapped to the display layout in create_plugin_tab() below */
@@ -655,6 +1347,7 @@ static GtkObject        *port_spin_adj;
 static GtkWidget        *port_spin;
 static GtkObject        *vers_spin_adj;
 static GtkWidget        *vers_spin;
+static GtkWidget        *tcp_button;
 static GtkWidget        *community_entry;
 static GtkWidget        *oid_entry;
 static GtkWidget        *elements_entry;
@@ -666,6 +1359,17 @@ static GtkWidget        *div_spin;
 static GtkWidget        *hide_button;
 static GtkWidget        *delta_button;
 static GtkWidget        *panel_button;
+static GtkObject        *meter_spin_adj;
+static GtkWidget        *meter_spin;
+static GtkWidget        *expr_entry;
+static GtkObject        *threads_spin_adj;
+static GtkWidget        *threads_spin;
+static GtkObject        *pipeline_spin_adj;
+static GtkWidget        *pipeline_spin;
+static GtkObject        *background_spin_adj;
+static GtkWidget        *background_spin;
+static GtkObject        *rate_spin_adj;
+static GtkWidget        *rate_spin;
 
 static GtkWidget        *reader_clist;
 static gint             selected_row = -1;
@@ -677,8 +1381,32 @@ static void
 save_plugin_config(FILE *f)
 {
   Reader *reader;
-  gchar *label, *format, *elements;
+  gchar *label, *format, *elements, *expression;
   gchar *unit = "_";
+  gchar delay[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar rate[G_ASCII_DTOSTR_BUF_SIZE];
+  GHashTableIter iter;
+  gpointer key, value;
+
+  /* Global options come first, so they apply before readers are created */
+  fprintf(f, "%s %s threads %d\n",
+	  PLUGIN_CONFIG_KEYWORD, PLUGIN_OPTION_KEYWORD, num_threads);
+  fprintf(f, "%s %s pipeline %d\n",
+	  PLUGIN_CONFIG_KEYWORD, PLUGIN_OPTION_KEYWORD, pipeline_depth);
+  fprintf(f, "%s %s background %d\n",
+	  PLUGIN_CONFIG_KEYWORD, PLUGIN_OPTION_KEYWORD, background);
+  g_ascii_formatd(rate, sizeof(rate), "%g", rate_limit);
+  fprintf(f, "%s %s rate %s\n",
+	  PLUGIN_CONFIG_KEYWORD, PLUGIN_OPTION_KEYWORD, rate);
+  /* only set in the config file, they are kept as they are */
+  if (agent_rates) {
+    g_hash_table_iter_init(&iter, agent_rates);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      g_ascii_formatd(rate, sizeof(rate), "%g", *(gdouble *)value);
+      fprintf(f, "%s %s agent_rate %s %s\n",
+	      PLUGIN_CONFIG_KEYWORD, PLUGIN_OPTION_KEYWORD, rate, (gchar *)key);
+    }
+  }
 
   for (reader = readers; reader ; reader = reader->next) {
       label = g_strdelimit(g_strdup(reader->label), STR_DELIMITERS, '_');
@@ -687,25 +1415,32 @@ save_plugin_config(FILE *f)
       if (label[0] == '\0') label = strdup("_");
       if (format[0] == '\0') format = strdup("_");
       if (elements[0]  == '\0') elements = strdup("_");
+      expression = g_strdelimit(g_strdup(reader->expression), STR_DELIMITERS, '_');
+      if (expression[0] == '\0') expression = strdup("_");
+      /* Fractional ticks, always with a '.' regardless of the locale */
+      g_ascii_formatd(delay, sizeof(delay), "%g", reader->delay);
 
       /* The layout of a config file entry is given by the following format, */
-      /* unit and scale are not used, but left in place in the config file */
-      fprintf(f, "%s %s snmp%s://%s@%s:%d/%s %s %d %d %d %d %d %s %d %s\n",
+      /* unit is not used, but left in place in the config file, */
+      /* the former chart scale is the full scale of a meter, 0 for a chart */
+      fprintf(f, "%s %s %s://%s@%s:%d/%s %s %s %d %d %d %d %s %d %s %s\n",
 	      PLUGIN_CONFIG_KEYWORD,
 	      label,
-		  reader->vers == 2 ? "-v2c" : "",
+		  reader_scheme(reader),
 		  reader->community,
 	      reader->peer, reader->port,
 	      reader->oid_base, unit,
-	      reader->delay, 
+	      delay, 
 //AG Multi: The following may need to be repeated for each oid_str
 	      reader->delta, reader->divisor, 
-	      0, reader->panel,
-	      format, reader->hideExtra, elements);
-      gkrellm_save_chartconfig(f, reader->chart_config, PLUGIN_CONFIG_KEYWORD, label);
+	      reader->meter, reader->panel,
+	      format, reader->hideExtra, elements, expression);
+      if (reader->chart_config)
+	gkrellm_save_chartconfig(f, reader->chart_config, PLUGIN_CONFIG_KEYWORD, label);
       g_free(label);
       g_free(format);
       g_free(elements);
+      g_free(expression);
   }
 }
 
@@ -719,9 +1454,39 @@ load_plugin_config(gchar *config_line)
   gchar   bufo[CFG_BUFSIZE], bufu[CFG_BUFSIZE];
   gchar   buft[CFG_BUFSIZE], peer[CFG_BUFSIZE];
   gchar   buff[CFG_BUFSIZE], bufe[CFG_BUFSIZE];
-  gint    old_scale;
+  gchar   bufd[CFG_BUFSIZE], bufx[CFG_BUFSIZE];
+  gchar   *transport, *port;
+  gdouble *rate;
   gint    n;
 
+  if (sscanf(config_line, PLUGIN_OPTION_KEYWORD " %s %[^\n]", bufl, bufc) == 2) {
+	if (!strcmp(bufl, "threads")) {
+	    num_threads = atoi(bufc);
+	    simpleSNMPset_threads(num_threads);
+	} else if (!strcmp(bufl, "pipeline")) {
+	    pipeline_depth = atoi(bufc);
+	    simpleSNMPset_pipeline(pipeline_depth);
+	} else if (!strcmp(bufl, "background")) {
+	    background = atoi(bufc);
+	} else if (!strcmp(bufl, "rate")) {
+	    rate_limit = MAX(g_ascii_strtod(bufc, NULL), 0);
+	    simpleSNMPset_rate(NULL, 0, rate_limit);
+	} else if (!strcmp(bufl, "agent_rate")
+		   && sscanf(bufc, "%s %s", bufd, peer) == 2
+		   && (port = strrchr(peer, ':')) != NULL) {
+	    /* agent_rate <PDUs/s> <peer>:<port>, the peer may have colons */
+	    rate = g_new(gdouble, 1);
+	    *rate = MAX(g_ascii_strtod(bufd, NULL), 0);
+	    if (!agent_rates)
+		agent_rates = g_hash_table_new_full(g_str_hash, g_str_equal,
+						    g_free, g_free);
+	    g_hash_table_replace(agent_rates, g_strdup(peer), rate);
+	    *port++ = '\0';
+	    simpleSNMPset_rate(peer, atoi(port), *rate);
+	}
+	return;
+  }
+
   if (sscanf(config_line, GKRELLM_CHARTCONFIG_KEYWORD " %s %[^\n]", bufl, bufc) == 2) {
 	g_strdelimit(bufl, "_", ' ');
 	/* look for any such reader */
@@ -753,41 +1518,55 @@ load_plugin_config(gchar *config_line)
 
   // TODO: re-enabling the plugin will load a duplicate config and crash
   reader = g_new0(Reader, 1); 
+  bufd[0] = '\0';
+  bufx[0] = '\0';
 
   /* The layout of a config file entry is given by one of the following formats */
-  /* unit and scale are not used, but left in place in the config file */
+  /* unit is not used, but left in place in the config file */
   n = sscanf(config_line, 
-		"%s %[^:]://%[^@]@%[^:]:%[^:]:%d/%s %s %d %d %d %d %d %s %d %s",
+		"%s %[^:]://%[^@]@%[^:]:%[^:]:%d/%s %s %s %d %d %d %d %s %d %s %s",
 	     bufl, proto, bufc, buft, bufp, &reader->port, 
 	     bufo, bufu,
-	     &reader->delay, 
+	     bufd, 
 //AG Multi: The following may need to be repeated for each oid_str
 	     &reader->delta, &reader->divisor, 
-	     &old_scale, &reader->panel,
-	     buff, &reader->hideExtra, bufe);
+	     &reader->meter, &reader->panel,
+	     buff, &reader->hideExtra, bufe, bufx);
   if (n >= 6) {
 	g_snprintf(peer, CFG_BUFSIZE, "%s:%s", buft, bufp);
 	peer[CFG_BUFSIZE-1] = '\0';
   } else
 	  n = sscanf(config_line, 
-			"%s %[^:]://%[^@]@%[^:]:%d/%s %s %d %d %d %d %d %s %d %s",
+			"%s %[^:]://%[^@]@%[^:]:%d/%s %s %s %d %d %d %d %s %d %s %s",
 	     bufl, proto, bufc, peer, &reader->port, 
 	     bufo, bufu,
-	     &reader->delay, 
+	     bufd, 
 //AG Multi: The following may need to be repeated for each oid_str
 	     &reader->delta, &reader->divisor, 
-	     &old_scale, &reader->panel,
-	     buff, &reader->hideExtra, bufe);
+	     &reader->meter, &reader->panel,
+	     buff, &reader->hideExtra, bufe, bufx);
   if (n >= 7)
     {
+      /* The transport is appended to the scheme, e.g. snmp+tcp */
+      reader->transport = TRANSPORT_UDP;
+      transport = strchr(proto, '+');
+      if (transport && g_ascii_strcasecmp(transport, "+tcp") == 0)
+	reader->transport = TRANSPORT_TCP;
+      if (transport && (g_ascii_strcasecmp(transport, "+tcp") == 0
+		      || g_ascii_strcasecmp(transport, "+udp") == 0))
+	*transport = '\0';
+
       if (g_ascii_strcasecmp(proto, "snmp") == 0
-      		|| g_ascii_strcasecmp(proto, "snmp-v2c") == 0) {
-	reader->vers = g_ascii_strcasecmp(proto, "snmp-v2c") == 0 ? 2 : 1;
+      		|| g_ascii_strcasecmp(proto, "snmp-v2c") == 0
+      		|| g_ascii_strcasecmp(proto, "snmp-v3") == 0) {
+	reader->vers = g_ascii_strcasecmp(proto, "snmp-v2c") == 0 ? 2
+		     : g_ascii_strcasecmp(proto, "snmp-v3") == 0 ? 3 : 1;
 	gkrellm_dup_string(&reader->label, bufl);
 	gkrellm_dup_string(&reader->community, bufc);
 	gkrellm_dup_string(&reader->peer, peer);
-	if (reader->delay < 2)
-	    reader->delay = 100;
+	reader->delay = g_ascii_strtod(bufd, NULL);
+	if (reader->delay < 1)
+	    reader->delay = DEFAULT_FREQ;
 
 	gkrellm_dup_string(&reader->oid_base, bufo);
 	/* Note, bufu is ignored, but left in place in the config file */
@@ -814,6 +1593,15 @@ load_plugin_config(gchar *config_line)
 
 	g_strdelimit(reader->label, "_", ' ');
 	g_strdelimit(reader->formatString, "_", ' ');
+
+	/* Older config files have no expressions, bufx stays empty */
+	if (bufx[0] == '_') {
+	    gkrellm_dup_string(&reader->expression, &bufx[1]);
+	} else {
+	    gkrellm_dup_string(&reader->expression, bufx);
+	}
+	g_strdelimit(reader->expression, "_", ' ');
+	prepare_expression (reader);
       }
 
       if (!readers)
@@ -833,6 +1621,20 @@ apply_plugin_config()
   gchar  *name;
   gint   row;
 
+  num_threads = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(threads_spin));
+  simpleSNMPset_threads(num_threads);
+  pipeline_depth = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(pipeline_spin));
+  simpleSNMPset_pipeline(pipeline_depth);
+  rate_limit = gtk_spin_button_get_value(GTK_SPIN_BUTTON(rate_spin));
+  simpleSNMPset_rate(NULL, 0, rate_limit);
+  if (background != gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(background_spin))) {
+    background = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(background_spin));
+    /* hidden readers switch over with the next update */
+    for (reader = readers; reader; reader = reader->next)
+      if (!reader->wanted)
+        reader->visible = TRUE;
+  }
+
   if (!list_modified)
     return;
 
@@ -862,6 +1664,10 @@ apply_plugin_config()
       gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
       reader->vers = atoi(name);
 
+      gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
+      reader->transport = (strcmp(name, "yes") == 0)
+				? TRANSPORT_TCP : TRANSPORT_UDP;
+
       gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
       gkrellm_dup_string(&reader->community, name);
 
@@ -874,7 +1680,7 @@ apply_plugin_config()
       prepare_oid_str (reader);
 
       gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
-      reader->delay = atoi(name);
+      reader->delay = g_ascii_strtod(name, NULL);
 
       gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
       gkrellm_dup_string(&reader->formatString, name);
@@ -891,6 +1697,13 @@ apply_plugin_config()
       gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
       reader->panel = (strcmp(name, "yes") == 0) ? TRUE : FALSE;
 
+      gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
+      reader->meter = atoi(name);
+
+      gtk_clist_get_text(GTK_CLIST(reader_clist), row, i++, &name);
+      gkrellm_dup_string(&reader->expression, name);
+      prepare_expression (reader);
+
       if (!readers)
           readers = reader;
       else { 
@@ -912,6 +1725,7 @@ reset_entries()
   // gtk_entry_set_text(GTK_ENTRY(port_entry), "");
   gtk_spin_button_set_value (GTK_SPIN_BUTTON(vers_spin), DEFAULT_VERS);
   // gtk_entry_set_text(GTK_ENTRY(vers_entry), "");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(tcp_button), FALSE);
   gtk_entry_set_text(GTK_ENTRY(community_entry), "");
   gtk_entry_set_text(GTK_ENTRY(oid_entry), "");
   gtk_entry_set_text(GTK_ENTRY(elements_entry), "");
@@ -923,6 +1737,8 @@ reset_entries()
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(hide_button), FALSE);
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(delta_button), FALSE);
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(panel_button), FALSE);
+  gtk_spin_button_set_value (GTK_SPIN_BUTTON(meter_spin), 0);
+  gtk_entry_set_text(GTK_ENTRY(expr_entry), "");
 }
 
 
@@ -951,6 +1767,10 @@ cb_clist_selected(GtkWidget *clist, gint row, gint column,
   gtk_entry_set_text(GTK_ENTRY(vers_spin), s);
   //  gtk_spin_button_get_value_as_int(GTK_SPINBUTTON(vers_spin), 1);
 
+  gtk_clist_get_text(GTK_CLIST(clist), row, i++, &s);
+  state = (strcmp(s, "yes") == 0) ? TRUE : FALSE;
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(tcp_button), state);
+
   gtk_clist_get_text(GTK_CLIST(clist), row, i++, &s);
   gtk_entry_set_text(GTK_ENTRY(community_entry), s);
 
@@ -961,7 +1781,7 @@ cb_clist_selected(GtkWidget *clist, gint row, gint column,
   gtk_entry_set_text(GTK_ENTRY(elements_entry), s);
 
   gtk_clist_get_text(GTK_CLIST(clist), row, i++, &s);
-  gtk_entry_set_text(GTK_ENTRY(freq_spin), s);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(freq_spin), g_ascii_strtod(s, NULL));
 
   gtk_clist_get_text(GTK_CLIST(clist), row, i++, &s);
   gtk_entry_set_text(GTK_ENTRY(format_entry), s);
@@ -981,6 +1801,12 @@ cb_clist_selected(GtkWidget *clist, gint row, gint column,
   state = (strcmp(s, "yes") == 0) ? TRUE : FALSE;
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(panel_button), state);
 
+  gtk_clist_get_text(GTK_CLIST(clist), row, i++, &s);
+  gtk_entry_set_text(GTK_ENTRY(meter_spin), s);
+
+  gtk_clist_get_text(GTK_CLIST(clist), row, i++, &s);
+  gtk_entry_set_text(GTK_ENTRY(expr_entry), s);
+
   selected_row = row;
 }
 
@@ -1032,8 +1858,12 @@ static void
 cb_enter(GtkWidget *widget)
 {
   gchar           *buf[CLIST_WIDTH];
+  gchar           delay[G_ASCII_DTOSTR_BUF_SIZE];
   gint            i;
 
+  g_ascii_formatd(delay, sizeof(delay), "%g",
+		  gtk_spin_button_get_value(GTK_SPIN_BUTTON(freq_spin)));
+
   i = 0;
   /* The order of this list must follow reader_clist, */
   /* which is based on reader_title[], defined above */
@@ -1041,18 +1871,21 @@ cb_enter(GtkWidget *widget)
   buf[i++] = gkrellm_gtk_entry_get_text(&peer_entry);
   buf[i++] = gkrellm_gtk_entry_get_text(&port_spin);
   buf[i++] = gkrellm_gtk_entry_get_text(&vers_spin);
+  buf[i++] = GTK_TOGGLE_BUTTON(tcp_button)->active ? "yes" : "no";
   buf[i++] = gkrellm_gtk_entry_get_text(&community_entry);
   buf[i++] = gkrellm_gtk_entry_get_text(&oid_entry);
   buf[i++] = gkrellm_gtk_entry_get_text(&elements_entry);
-  buf[i++] = gkrellm_gtk_entry_get_text(&freq_spin);
+  buf[i++] = delay;
   buf[i++] = gkrellm_gtk_entry_get_text(&format_entry);
   buf[i++] = gkrellm_gtk_entry_get_text(&div_spin);
   buf[i++] = GTK_TOGGLE_BUTTON(hide_button)->active ? "yes" : "no";
   buf[i++] = GTK_TOGGLE_BUTTON(delta_button)->active ? "yes" : "no";
   buf[i++] = GTK_TOGGLE_BUTTON(panel_button)->active ? "yes" : "no";
+  buf[i++] = gkrellm_gtk_entry_get_text(&meter_spin);
+  buf[i++] = gkrellm_gtk_entry_get_text(&expr_entry);
 
   /* validate we have input */
-  if (!*(buf[1]) || !*(buf[2]) || !*(buf[3]) || !*(buf[4]))
+  if (!*(buf[1]) || !*(buf[2]) || !*(buf[3]) || !*(buf[5]))
     {
       gkrellm_config_message_dialog("Entry Error",
 			"Peer, Port, Community and OID must be entered.");
@@ -1089,12 +1922,15 @@ cb_probe(GtkWidget *widget)
 	gchar *peer;
 	gint port;
 	gint vers;
+	gint transport;
 	gchar *community;
 	gchar *probe;
 
 	peer = gkrellm_gtk_entry_get_text(&peer_entry);
 	port = atoi(gkrellm_gtk_entry_get_text(&port_spin));
 	vers = atoi(gkrellm_gtk_entry_get_text(&vers_spin));
+	transport = GTK_TOGGLE_BUTTON(tcp_button)->active
+				? TRANSPORT_TCP : TRANSPORT_UDP;
 	community = gkrellm_gtk_entry_get_text(&community_entry);
 
 	/* validate we have input */
@@ -1104,7 +1940,7 @@ cb_probe(GtkWidget *widget)
 			"Peer, Port and Community must be entered.");
 		return;
 	}
-	probe = simpleSNMPprobe(peer, port, vers, community);
+	probe = simpleSNMPprobe(peer, port, vers, community, transport);
 	gkrellm_config_message_dialog("SNMP Probe", probe);
 	g_free(probe);
 }
@@ -1114,18 +1950,61 @@ static gchar    *plugin_info_text[] = {
 "This configuration tab is for the SNMP monitor plugin.\n"
 "\n"
 "Adding new SNMP readers should be fairly easy.\n",
-"<i>Label -", " is a unique name that gets prepended to your reader.\n",
-"<i>Peer, Port, and Community -", " are the respective SNMP parameters.\n"
-"You can prepend a specific transport to the peer name.\n"
-"(i.e. tcp:192.168.0.1)\n",
+"<i>Label -", " is a unique name that gets prepended to your reader.\n"
+"It also names the reader's history file in ~/.gkrellm2/data/snmp/, which\n"
+"keeps the recent chart values and the last counters across restarts.\n",
+"<i>Peer, Port, and Community -", " are the respective SNMP parameters.\n",
+"<i>v -", " is the SNMP version, 1, 2 (v2c) or 3. For version 3 the community\n"
+"is the user and its passphrases, user:authpass:privpass for authPriv\n"
+"(SHA, AES), user:authpass for authNoPriv or just user. The agent's engine\n"
+"is discovered and the keys are computed once, all readers share them.\n"
+"In the config file this is the scheme snmp-v3://.\n",
+"<i>TCP -", " talks to the agent over TCP instead of UDP. All TCP readers of\n"
+"an agent share one connection and pipeline their requests on it. A lost\n"
+"connection is reopened, waiting longer after each failure (up to a minute).\n"
+"In the config file this is the scheme snmp+tcp:// or snmp-v2c+tcp://.\n",
 "<i>Port -", " ist preselected with the default value 161.\n",
+"<i>Compute delta -", " charts the rate per second of counters. After an agent\n"
+"reboot or a counter reset the sample is left out rather than charted\n"
+"as a spike, and labels show '-' for it.\n"
+"\n",
 "<i>Freq -", " sets the delay between updates of the reader value.\n"
 "It's measured in GKrellM ticks -- as specified under General Options.\n"
+"Fractions of ticks are allowed, e.g. 2.5 ticks at 10 updates per second\n"
+"poll every 250 ms. Samples are timestamped locally when received\n"
+"(corrected by half the round trip time) and rates are computed from that.\n"
+"\n",
+"<i>Threads -", " sets the number of SNMP worker threads. Agents are\n"
+"spread over the threads, all readers of one agent share a thread.\n"
+"A change applies to readers created afterwards.\n"
+"\n",
+"<i>Pipeline -", " sets how many updates of a reader may be in flight at\n"
+"once. Over links with a round trip time longer than Freq, more than 1\n"
+"keeps the update rate up. Values are still taken in the order they were\n"
+"asked for.\n"
+"\n",
+"<i>Hidden -", " sets the update interval in seconds of readers nobody\n"
+"looks at: charts that are hidden, or show neither a label nor a visible\n"
+"series, and all charts while GKrellM is iconified. 0 stops their updates,\n"
+"the first delta afterwards is left out. They are back at Freq as soon as\n"
+"they are shown.\n"
+"\n",
+"<i>Rate -", " limits the requests sent to any one agent, in PDUs per second,\n"
+"0 for no limit. Updates over the limit are held back until the agent's\n"
+"budget allows them, their OIDs go with the next request. Agents that need\n"
+"a limit of their own get a line in the config file, e.g.\n"
+"  snmp_monitor snmp_option agent_rate 2 ups.example.org:161\n"
+"The reader's tooltip shows the share of updates held back.\n"
 "\n",
 "<i>OID -", " is either a complete SNMP OID, or a base OID containing '%s'.\n",
 "<i>Elements -", " contains a comma separated list of elements to be inserted\n"
 "individually into the base OID, in order to create a list of SNMP OID's.\n"
 "If the OID entry doesn't contain '%s', Elements is ignored.\n"
+"An OID (or element) may end in a refresh class: @N to fetch it with\n"
+"every N-th update only, @static to fetch it once, e.g. for ifDescr.\n"
+"Static values are fetched again after the agent rebooted.\n"
+"OIDs the agent has no value for are shown as '-' and left out of the\n"
+"requests, they are rechecked with a growing delay.\n"
 "Up to 10 SNMP OID's may be created, the values returned for the\n"
 "first 3 will be charted, the remaining ones are available for formatting.\n"
 "\n",
@@ -1135,6 +2014,35 @@ static gchar    *plugin_info_text[] = {
 "$M the maximum chart value, $I the sample interval,\n"
 "and $0 up to $9 and $S0 up to $S9 for the values, or the\n"
 "auto scaled values respectively, returned for the defined OID's.\n"
+"$X0 up to $X9 (or $SX0 up to $SX9) are the values of the Expressions.\n"
+"\n",
+"<i>Meter -", " shows the reader as a meter instead of a chart, a single row\n"
+"with a krell and the Format text, for dashboards with many readers.\n"
+"The value is the full scale of the krell, which shows the first value\n"
+"(or the first Expression). 0 creates a chart. Meters keep no history.\n"
+"\n",
+"<i>Expressions -", " derive series from the samples, separated by ';'.\n"
+"$0 up to $9 are the raw values of the OID's, [Label]$0 those of the\n"
+"reader with that Label on the same agent. rate($0) is the change per\n"
+"second, delta($0) the change since the last sample, and + - * / ( ),\n"
+"abs(), min(,) and max(,) combine them. If there are expressions, the\n"
+"first 3 are charted instead of the OID values, e.g. the total traffic\n"
+"in bits per second of two interfaces:\n"
+"  rate($0)*8 + rate([eth1]$0)*8\n"
+"\n"
+"The latest values, deltas and rates of all readers are published in the\n"
+"shared memory segment /gkrellm_snmp.<uid>, so other local programs can\n"
+"read them without asking the agents again. The layout is in\n"
+"gkrellm_snmp_shm.h (make install-header).\n"
+"\n"
+"Started with GKRELLM_SNMP_RECORD=<file> in the environment, all SNMP\n"
+"traffic is recorded to that file. replay_snmp plays it back through the\n"
+"poller without any agents, to measure it or to report a problem.\n"
+"\n"
+"For many devices, discover_snmp (make discover_snmp) finds the agents in\n"
+"address ranges, e.g. discover_snmp -c public 10.1.0.0/22, and writes\n"
+"reader definitions from templates per sysObjectID. Append them to\n"
+"~/.gkrellm2/user-config while GKrellM isn't running.\n"
 "\n"
 "Some examples:\n"
 "\n"
@@ -1190,6 +2098,7 @@ create_plugin_tab(GtkWidget *tab_vbox)
   GtkWidget               *label;
 
   gchar                   *buf[CLIST_WIDTH];
+  gchar                   delay[G_ASCII_DTOSTR_BUF_SIZE];
   gchar                   *about_text;
   gint                    row, i;
 
@@ -1229,16 +2138,43 @@ create_plugin_tab(GtkWidget *tab_vbox)
 
 	label = gtk_label_new("v : ");
 	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
-	vers_spin_adj = gtk_adjustment_new (DEFAULT_VERS, 1, 2, 1, 1, 0);
+	vers_spin_adj = gtk_adjustment_new (DEFAULT_VERS, 1, 3, 1, 1, 0);
 	vers_spin = gtk_spin_button_new (GTK_ADJUSTMENT (vers_spin_adj), 1, 0);
 	gtk_box_pack_start(GTK_BOX(hbox),vers_spin,FALSE,FALSE,0);
 
+        tcp_button = gtk_check_button_new_with_label("TCP");
+        gtk_box_pack_start(GTK_BOX(hbox),tcp_button,FALSE,FALSE,0);
+
 	label = gtk_label_new("Freq : ");
 	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
-	freq_spin_adj = gtk_adjustment_new (DEFAULT_FREQ, 2, 6000, 2, 100, 0);
-	freq_spin = gtk_spin_button_new (GTK_ADJUSTMENT (freq_spin_adj), 1, 0);
+	freq_spin_adj = gtk_adjustment_new (DEFAULT_FREQ, 1, 6000, 0.5, 100, 0);
+	freq_spin = gtk_spin_button_new (GTK_ADJUSTMENT (freq_spin_adj), 1, 1);
 	gtk_box_pack_start(GTK_BOX(hbox),freq_spin,FALSE,FALSE,0);
 
+	label = gtk_label_new("Threads : ");
+	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
+	threads_spin_adj = gtk_adjustment_new (num_threads, 1, 64, 1, 1, 0);
+	threads_spin = gtk_spin_button_new (GTK_ADJUSTMENT (threads_spin_adj), 1, 0);
+	gtk_box_pack_start(GTK_BOX(hbox),threads_spin,FALSE,FALSE,0);
+
+	label = gtk_label_new("Pipeline : ");
+	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
+	pipeline_spin_adj = gtk_adjustment_new (pipeline_depth, 1, MAX_PIPELINE, 1, 1, 0);
+	pipeline_spin = gtk_spin_button_new (GTK_ADJUSTMENT (pipeline_spin_adj), 1, 0);
+	gtk_box_pack_start(GTK_BOX(hbox),pipeline_spin,FALSE,FALSE,0);
+
+	label = gtk_label_new("Hidden : ");
+	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
+	background_spin_adj = gtk_adjustment_new (background, 0, 3600, 1, 60, 0);
+	background_spin = gtk_spin_button_new (GTK_ADJUSTMENT (background_spin_adj), 1, 0);
+	gtk_box_pack_start(GTK_BOX(hbox),background_spin,FALSE,FALSE,0);
+
+	label = gtk_label_new("Rate : ");
+	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
+	rate_spin_adj = gtk_adjustment_new (rate_limit, 0, 1000, 0.5, 10, 0);
+	rate_spin = gtk_spin_button_new (GTK_ADJUSTMENT (rate_spin_adj), 1, 1);
+	gtk_box_pack_start(GTK_BOX(hbox),rate_spin,FALSE,FALSE,0);
+
 	gtk_container_add(GTK_CONTAINER(vbox),hbox);
 
 	/* This is the second line of the layout */
@@ -1288,6 +2224,12 @@ create_plugin_tab(GtkWidget *tab_vbox)
         panel_button = gtk_check_button_new_with_label("Create Panel");
         gtk_box_pack_start(GTK_BOX(hbox),panel_button,FALSE,FALSE,0);
 
+	label = gtk_label_new("Meter : ");
+	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
+	meter_spin_adj = gtk_adjustment_new (0, 0, G_MAXINT, 1, 100, 0);
+	meter_spin = gtk_spin_button_new (GTK_ADJUSTMENT (meter_spin_adj), 1, 0);
+	gtk_box_pack_start(GTK_BOX(hbox),meter_spin,FALSE,FALSE,0);
+
         button = gtk_button_new_with_label("Probe");
         gtk_signal_connect(GTK_OBJECT(button), "clicked",
 			   (GtkSignalFunc) cb_probe, NULL);
@@ -1296,6 +2238,17 @@ create_plugin_tab(GtkWidget *tab_vbox)
 	gtk_container_add(GTK_CONTAINER(vbox),hbox);
 
 	/* This is the fourth line of the layout */
+	hbox = gtk_hbox_new(FALSE,0);
+
+	label = gtk_label_new("Expressions : ");
+	gtk_box_pack_start(GTK_BOX(hbox),label,FALSE,FALSE,0);
+	expr_entry = gtk_entry_new();
+	gtk_entry_set_text(GTK_ENTRY(expr_entry), "");
+	gtk_box_pack_start(GTK_BOX(hbox),expr_entry,TRUE,TRUE,0);
+
+	gtk_container_add(GTK_CONTAINER(vbox),hbox);
+
+	/* This is the fifth line of the layout */
         hbox = gtk_hbox_new(FALSE, 3);
         gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 2);
 	/*
@@ -1360,15 +2313,19 @@ create_plugin_tab(GtkWidget *tab_vbox)
 	    buf[i++] = reader->peer;
 	    buf[i++] = g_strdup_printf("%d", reader->port);
 	    buf[i++] = g_strdup_printf("%d", reader->vers);
+	    buf[i++] = reader->transport == TRANSPORT_TCP ? "yes" : "no";
 	    buf[i++] = reader->community;
 	    buf[i++] = reader->oid_base;
 	    buf[i++] = reader->oid_elements;
-	    buf[i++] = g_strdup_printf("%d", reader->delay);
+	    buf[i++] = g_strdup(g_ascii_formatd(delay, sizeof(delay), "%g",
+							reader->delay));
 	    buf[i++] = reader->formatString;
 	    buf[i++] = g_strdup_printf("%d", reader->divisor);
 	    buf[i++] = reader->hideExtra ? "yes" : "no";
 	    buf[i++] = reader->delta ? "yes" : "no";
 	    buf[i++] = reader->panel ? "yes" : "no";
+	    buf[i++] = g_strdup_printf("%d", reader->meter);
+	    buf[i++] = reader->expression;
 	    row = gtk_clist_append(GTK_CLIST(reader_clist), buf);
 	  }
 
@@ -1416,15 +2373,29 @@ static GkrellmMonitor  plugin_mon  =
         NULL                   /* path if a plugin, filled in by GKrellM   */
         };
 
+/* Other tools must not take the values of a disabled plugin as current */
+static void
+disable_plugin(void)
+{
+    publish_close(publisher);
+    publisher = NULL;
+}
+
 GkrellmMonitor *
 gkrellm_init_plugin(void)
 {
     readers = NULL;
 
     style_id = gkrellm_add_chart_style(&plugin_mon, PLUGIN_STYLE_ID);
+    meter_style_id = gkrellm_add_meter_style(&plugin_mon, PLUGIN_METER_STYLE_ID);
 
     simpleSNMPinit();
+    if (g_getenv("GKRELLM_SNMP_RECORD"))
+	simpleSNMPrecord(g_getenv("GKRELLM_SNMP_RECORD"));
+    samples = samples_new(MAX_FORMAT_VALUES);
+    publisher = publish_open();
     
     mon = &plugin_mon;
+    gkrellm_disable_plugin_connect(mon, disable_plugin);
     return &plugin_mon;
 }
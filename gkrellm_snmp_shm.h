@@ -0,0 +1,130 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+
+#ifndef GKRELLM_SNMP_SHM_H
+#define GKRELLM_SNMP_SHM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*
+ * The latest samples of all readers, published by the plugin in a POSIX
+ * shared memory segment for other processes of the same user.  This
+ * header is all a consumer needs, it doesn't depend on GKrellM or glib:
+ *
+ *   char name[64];
+ *   int fd;
+ *   const struct snmp_shm *shm;
+ *   struct snmp_shm_entry entry;
+ *
+ *   snmp_shm_name(name, sizeof(name));
+ *   fd = shm_open(name, O_RDONLY, 0);
+ *   shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+ *   if (shm->magic == SNMP_SHM_MAGIC && shm->version == SNMP_SHM_VERSION)
+ *       for (i = 0; i < SNMP_SHM_ENTRIES; i++)
+ *           if (snmp_shm_read(&shm->entry[i], &entry) && entry.used)
+ *               ...
+ *
+ * Each entry is guarded by a sequence lock: the plugin makes seq odd
+ * before it changes an entry and even again afterwards, a reader copies
+ * the entry and retries if seq was odd or has changed meanwhile.  Reading
+ * takes no system call and no lock, and never holds up the plugin.
+ */
+
+#define SNMP_SHM_MAGIC		0x504d4e53	/* "SNMP" */
+#define SNMP_SHM_VERSION	1
+
+#define SNMP_SHM_ENTRIES	256
+#define SNMP_SHM_VALUES		10
+#define SNMP_SHM_LABEL		32
+#define SNMP_SHM_PEER		64
+
+struct snmp_shm_entry {
+	uint32_t		seq;		/* odd while being written */
+	uint32_t		used;		/* 0 for a free entry */
+	char			label[SNMP_SHM_LABEL];	/* of the reader */
+	char			peer[SNMP_SHM_PEER];
+	uint32_t		port;
+	uint32_t		num_values;
+	uint32_t		gap;		/* mask of values w/o delta */
+	uint32_t		missing;	/* mask of values w/o value */
+	int64_t			time;		/* CLOCK_MONOTONIC usec */
+	int64_t			uptime;		/* agent's TimeTicks, -1 if unknown */
+	int64_t			value[SNMP_SHM_VALUES];	/* raw */
+	double			delta[SNMP_SHM_VALUES];	/* since the last sample */
+	double			rate[SNMP_SHM_VALUES];	/* per second */
+	uint32_t		reserved[2];
+};
+
+struct snmp_shm {
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		entry_size;	/* sizeof(struct snmp_shm_entry) */
+	uint32_t		num_entries;
+	int32_t			pid;		/* of the publishing GKrellM */
+	uint32_t		reserved;
+	int64_t			updated;	/* CLOCK_MONOTONIC usec */
+	struct snmp_shm_entry	entry[SNMP_SHM_ENTRIES];
+};
+
+/* The name of the segment, one per user */
+static inline int
+snmp_shm_name(char *buf, size_t size)
+{
+	return snprintf(buf, size, "/gkrellm_snmp.%u", (unsigned)getuid());
+}
+
+/* Take a consistent copy of an entry, 0 if it's changing too often */
+static inline int
+snmp_shm_read(const struct snmp_shm_entry *entry,
+	      struct snmp_shm_entry *copy)
+{
+	uint32_t seq;
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(copy, (const void *)entry, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq)
+			return 1;
+	}
+	return 0;
+}
+
+#endif /* GKRELLM_SNMP_SHM_H */
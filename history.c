@@ -0,0 +1,177 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+
+
+/*
+ * The file is a header, the counters and the ring of records, each one
+ * a wall clock usec timestamp followed by num_values values.  It is only
+ * ever used on the host that wrote it, so it's in native byte order.
+ */
+
+#define HISTORY_MAGIC	0x504d4e53	/* "SNMP" */
+#define HISTORY_VERSION	1
+
+typedef struct {
+	guint32			magic;
+	guint32			version;
+	guint32			fingerprint;	/* of the reader's setup */
+	guint32			length;
+	guint32			num_values;
+	guint32			num_counters;
+	guint64			count;		/* records ever appended */
+} HistoryHeader;
+
+struct History {
+	HistoryHeader		*header;
+	HistoryCounter		*counters;
+	gint64			*records;
+	gsize			size;
+	gint			record_len;	/* in gint64 */
+};
+
+
+History *
+history_open(const gchar *path, guint32 fingerprint,
+	     gint num_values, gint num_counters)
+{
+    History *history;
+    HistoryHeader *header;
+    struct stat st;
+    gsize size;
+    gint fd;
+
+    size = sizeof(HistoryHeader) + num_counters * sizeof(HistoryCounter)
+	   + HISTORY_LENGTH * (1 + num_values) * sizeof(gint64);
+
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+	perror(path);
+	return NULL;
+    }
+    if (fstat(fd, &st) < 0 || ((gsize)st.st_size != size
+	    && (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0))) {
+	perror(path);
+	close(fd);
+	return NULL;
+    }
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    /* the mapping stays valid without the descriptor */
+    close(fd);
+    if (header == MAP_FAILED) {
+	perror(path);
+	return NULL;
+    }
+
+    /* a file of another version or another setup starts over */
+    if (header->magic != HISTORY_MAGIC
+	    || header->version != HISTORY_VERSION
+	    || header->fingerprint != fingerprint
+	    || header->length != HISTORY_LENGTH
+	    || header->num_values != num_values
+	    || header->num_counters != num_counters) {
+	memset(header, 0, size);
+	header->magic = HISTORY_MAGIC;
+	header->version = HISTORY_VERSION;
+	header->fingerprint = fingerprint;
+	header->length = HISTORY_LENGTH;
+	header->num_values = num_values;
+	header->num_counters = num_counters;
+    }
+
+    history = g_new0(History, 1);
+    history->header = header;
+    history->counters = (HistoryCounter *)(header + 1);
+    history->records = (gint64 *)(history->counters + num_counters);
+    history->size = size;
+    history->record_len = 1 + num_values;
+    return history;
+}
+
+void
+history_close(History *history)
+{
+    if (!history)
+	return;
+    munmap(history->header, history->size);
+    g_free(history);
+}
+
+void
+history_append(History *history, gint64 time, const gulong *values)
+{
+    gint64 *record;
+    gint i;
+
+    record = history->records + (history->header->count % HISTORY_LENGTH)
+						* history->record_len;
+    record[0] = time;
+    for (i = 1; i < history->record_len; i++)
+	record[i] = values[i - 1];
+    /* count last, a record cut short by a crash is never read */
+    history->header->count++;
+}
+
+gint
+history_length(History *history)
+{
+    return MIN(history->header->count, HISTORY_LENGTH);
+}
+
+/* The i-th record still kept, the oldest first, returns its time */
+gint64
+history_get(History *history, gint i, gulong *values)
+{
+    gint64 *record;
+    guint64 n;
+    gint k;
+
+    n = history->header->count - history_length(history) + i;
+    record = history->records + (n % HISTORY_LENGTH) * history->record_len;
+    for (k = 1; k < history->record_len; k++)
+	values[k - 1] = record[k];
+    return record[0];
+}
+
+HistoryCounter *
+history_counters(History *history)
+{
+    return history->counters;
+}
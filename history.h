@@ -0,0 +1,62 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+
+#include <glib.h>
+
+
+/*
+ * Persistent sample history.  Each reader keeps a fixed-size ring of its
+ * recent chart values in a memory-mapped file, together with the last raw
+ * value of each counter as the baseline of the next delta.  Appending is
+ * a plain memory write, the kernel writes the pages back on its own, and
+ * on startup the history is back as soon as the file is mapped.
+ */
+
+#define HISTORY_LENGTH	1024	/* records kept per reader */
+
+typedef struct History History;
+
+/* The last raw value of a counter, time is wall clock usec, 0 if unset */
+typedef struct {
+	gint64			value;
+	gint64			time;
+} HistoryCounter;
+
+extern	History *history_open(const gchar *path, guint32 fingerprint,
+				gint num_values, gint num_counters);
+extern	void history_close(History *history);
+extern	void history_append(History *history, gint64 time,
+				const gulong *values);
+extern	gint history_length(History *history);
+extern	gint64 history_get(History *history, gint i, gulong *values);
+extern	HistoryCounter *history_counters(History *history);
@@ -0,0 +1,232 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "publish.h"
+#include "gkrellm_snmp_shm.h"
+
+
+struct Publisher {
+	struct snmp_shm		*shm;
+	gchar			name[64];
+};
+
+/* The segment of a GKrellM that is gone may be taken over */
+static gboolean
+publisher_alive(gint fd)
+{
+    struct snmp_shm *shm;
+    struct stat st;
+    gboolean alive = FALSE;
+
+    if (fstat(fd, &st) < 0 || (gsize)st.st_size != sizeof(*shm))
+	return FALSE;
+    shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+	return FALSE;
+    if (shm->magic == SNMP_SHM_MAGIC && shm->pid > 0 && shm->pid != getpid())
+	alive = kill(shm->pid, 0) == 0 || errno == EPERM;
+    munmap(shm, sizeof(*shm));
+    return alive;
+}
+
+/* The sequence lock, see gkrellm_snmp_shm.h */
+static void
+write_begin(struct snmp_shm_entry *entry)
+{
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+write_end(struct snmp_shm_entry *entry)
+{
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
+
+Publisher *
+publish_open(void)
+{
+    Publisher *publisher;
+    struct snmp_shm *shm;
+    struct stat st;
+    gchar name[64];
+    gint fd, i;
+
+    snmp_shm_name(name, sizeof(name));
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+	fd = shm_open(name, O_RDWR, 0600);
+	if (fd >= 0 && publisher_alive(fd)) {
+	    close(fd);
+	    return NULL;
+	}
+    }
+    if (fd < 0) {
+	perror(name);
+	return NULL;
+    }
+    /*
+     * A consumer may still have a taken over segment mapped, shrinking
+     * it would kill that consumer with SIGBUS.  So it only ever grows.
+     */
+    if (fstat(fd, &st) < 0 || ((gsize)st.st_size < sizeof(*shm)
+				&& ftruncate(fd, sizeof(*shm)) < 0)) {
+	perror(name);
+	close(fd);
+	return NULL;
+    }
+    shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    /* the mapping stays valid without the descriptor */
+    close(fd);
+    if (shm == MAP_FAILED) {
+	perror(name);
+	return NULL;
+    }
+
+    /*
+     * A taken over segment is cleared entry by entry under their sequence
+     * locks, so a consumer sees each one old or free.  The magic goes last.
+     */
+    __atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < SNMP_SHM_ENTRIES; i++) {
+	write_begin(&shm->entry[i]);
+	memset((gchar *)&shm->entry[i] + sizeof(shm->entry[i].seq), 0,
+	       sizeof(shm->entry[i]) - sizeof(shm->entry[i].seq));
+	write_end(&shm->entry[i]);
+    }
+    shm->version = SNMP_SHM_VERSION;
+    shm->entry_size = sizeof(struct snmp_shm_entry);
+    shm->num_entries = SNMP_SHM_ENTRIES;
+    shm->pid = getpid();
+    shm->updated = g_get_monotonic_time();
+    __atomic_store_n(&shm->magic, SNMP_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    publisher = g_new0(Publisher, 1);
+    publisher->shm = shm;
+    g_strlcpy(publisher->name, name, sizeof(publisher->name));
+    return publisher;
+}
+
+void
+publish_close(Publisher *publisher)
+{
+    if (!publisher)
+	return;
+    munmap(publisher->shm, sizeof(*publisher->shm));
+    shm_unlink(publisher->name);
+    g_free(publisher);
+}
+
+/* An entry for a reader, -1 if the table is full */
+gint
+publish_slot(Publisher *publisher, const gchar *label,
+	     const gchar *peer, gint port)
+{
+    struct snmp_shm_entry *entry;
+    gint slot;
+
+    if (!publisher)
+	return -1;
+    for (slot = 0; slot < SNMP_SHM_ENTRIES; slot++)
+	if (!publisher->shm->entry[slot].used)
+	    break;
+    if (slot == SNMP_SHM_ENTRIES)
+	return -1;
+
+    entry = &publisher->shm->entry[slot];
+    write_begin(entry);
+    g_strlcpy(entry->label, label ? label : "", sizeof(entry->label));
+    g_strlcpy(entry->peer, peer ? peer : "", sizeof(entry->peer));
+    entry->port = port;
+    entry->num_values = 0;
+    entry->gap = 0;
+    entry->missing = 0;
+    entry->time = 0;
+    entry->uptime = -1;
+    entry->used = 1;
+    write_end(entry);
+    return slot;
+}
+
+void
+publish_release(Publisher *publisher, gint slot)
+{
+    struct snmp_shm_entry *entry;
+
+    if (!publisher || slot < 0)
+	return;
+    entry = &publisher->shm->entry[slot];
+    write_begin(entry);
+    entry->used = 0;
+    write_end(entry);
+}
+
+void
+publish_sample(Publisher *publisher, gint slot, gint num_values,
+	       const gint64 *value, const gdouble *delta, const gdouble *rate,
+	       gint64 time, guint gap, guint missing, gint64 uptime)
+{
+    struct snmp_shm_entry *entry;
+
+    if (!publisher || slot < 0)
+	return;
+    num_values = MIN(num_values, SNMP_SHM_VALUES);
+    entry = &publisher->shm->entry[slot];
+    write_begin(entry);
+    entry->num_values = num_values;
+    entry->gap = gap;
+    entry->missing = missing;
+    entry->time = time;
+    entry->uptime = uptime;
+    memcpy(entry->value, value, num_values * sizeof(*value));
+    memcpy(entry->delta, delta, num_values * sizeof(*delta));
+    memcpy(entry->rate, rate, num_values * sizeof(*rate));
+    write_end(entry);
+}
+
+/* Tell consumers the publisher is still there */
+void
+publish_tick(Publisher *publisher)
+{
+    if (publisher)
+	__atomic_store_n(&publisher->shm->updated, g_get_monotonic_time(),
+							__ATOMIC_RELAXED);
+}
@@ -0,0 +1,55 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+
+#include <glib.h>
+
+
+/*
+ * Publication of the latest samples of each reader in shared memory, for
+ * other local tools polling the same agents.  The layout is defined in
+ * gkrellm_snmp_shm.h.  Only one GKrellM of a user publishes, a second one
+ * finds the segment taken and goes without.
+ */
+
+typedef struct Publisher Publisher;
+
+extern	Publisher *publish_open(void);
+extern	void publish_close(Publisher *publisher);
+extern	gint publish_slot(Publisher *publisher, const gchar *label,
+				const gchar *peer, gint port);
+extern	void publish_release(Publisher *publisher, gint slot);
+extern	void publish_sample(Publisher *publisher, gint slot, gint num_values,
+				const gint64 *value, const gdouble *delta,
+				const gdouble *rate, gint64 time,
+				guint gap, guint missing, gint64 uptime);
+extern	void publish_tick(Publisher *publisher);
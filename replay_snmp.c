@@ -0,0 +1,570 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+/*
+ * Replays a capture (see capture.h, recorded with GKRELLM_SNMP_RECORD set)
+ * through the SNMP engine, without any agents: the net-snmp session
+ * functions the engine uses are replaced at link time by the ones below,
+ * which answer each request from the capture after the round trip time
+ * recorded for that agent, or at once with -m.  The results go through
+ * the sample store like in the plugin, and the throughput and the latency
+ * of the handoff to the GTK thread are reported.  The charts are left out,
+ * drawing needs a display.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#define RECEIVED_MESSAGE NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE
+#define TIMED_OUT NETSNMP_CALLBACK_OP_TIMED_OUT
+
+#include <simpleSNMP.h>
+#include <capture.h>
+#include <samples.h>
+
+
+/*
+ * What the capture says about the agents.  The varbinds are replayed per
+ * OID, not per request: the engine may well group the OIDs differently
+ * than when recording, e.g. with other refresh timing.  Each agent and
+ * each OID cycles through its recorded round trips and values.
+ */
+
+typedef struct {
+	gint64			rtt;		/* usec, until given up if lost */
+	gboolean		lost;
+} ReplayTrip;
+
+typedef struct {
+	GArray			*trips;		/* ReplayTrip */
+	guint			next;
+} ReplayAgent;
+
+typedef struct {
+	GPtrArray		*vars;		/* struct variable_list * */
+	guint			next;
+} ReplayOid;
+
+typedef struct {
+	gchar			*agent;
+	gint64			sent;
+} ReplayRequest;
+
+static GMutex replay_lock;
+static GHashTable *replay_agents;	/* by "peer:port" */
+static GHashTable *replay_oids;		/* by "peer:port/.1.3.6..." */
+static GPtrArray *replay_pdus;		/* the responses, owning the vars */
+static gboolean max_speed;
+static gint last_reqid;
+
+static gchar *
+oid_key(const gchar *agent, oid *name, size_t name_length)
+{
+    GString *key = g_string_new(agent);
+    size_t k;
+
+    g_string_append_c(key, '/');
+    for (k = 0; k < name_length; k++)
+	g_string_append_printf(key, ".%lu", (gulong)name[k]);
+    return g_string_free(key, FALSE);
+}
+
+static ReplayAgent *
+replay_agent(const gchar *agent)
+{
+    ReplayAgent *ra = g_hash_table_lookup(replay_agents, agent);
+
+    if (!ra) {
+	ra = g_new0(ReplayAgent, 1);
+	ra->trips = g_array_new(FALSE, FALSE, sizeof(ReplayTrip));
+	g_hash_table_insert(replay_agents, g_strdup(agent), ra);
+    }
+    return ra;
+}
+
+static void
+learn_response(const gchar *agent, struct snmp_pdu *pdu)
+{
+    struct variable_list *vars;
+    ReplayOid *ro;
+    gchar *key;
+
+    g_ptr_array_add(replay_pdus, pdu);
+    for (vars = pdu->variables; vars; vars = vars->next_variable) {
+	key = oid_key(agent, vars->name, vars->name_length);
+	ro = g_hash_table_lookup(replay_oids, key);
+	if (!ro) {
+	    ro = g_new0(ReplayOid, 1);
+	    ro->vars = g_ptr_array_new();
+	    g_hash_table_insert(replay_oids, key, ro);
+	} else {
+	    g_free(key);
+	}
+	g_ptr_array_add(ro->vars, vars);
+    }
+}
+
+/*
+ * Reads the capture, the sessions as set up go to setups, the exchanges
+ * to the tables above.  Returns the length of the capture in usec.
+ */
+static gint64
+load_capture(const gchar *path, GPtrArray *setups, gint *num_trips)
+{
+    Capture *capture;
+    CaptureEntry entry;
+    CaptureEntry *setup;
+    GHashTable *peers, *requests;
+    ReplayRequest *request;
+    ReplayTrip trip;
+    gint64 length = 0;
+
+    capture = capture_open(path);
+    if (!capture)
+	exit(1);
+
+    peers = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+							NULL, g_free);
+    requests = g_hash_table_new(g_direct_hash, g_direct_equal);
+    while (capture_next(capture, &entry)) {
+	length = MAX(length, entry.time);
+	switch (entry.kind) {
+	case CAPTURE_SESSION:
+	    setup = g_memdup2(&entry, sizeof(entry));
+	    g_ptr_array_add(setups, setup);
+	    g_hash_table_insert(peers, GUINT_TO_POINTER(entry.session),
+		g_strdup_printf("%s:%d", entry.peername, entry.port));
+	    /* the strings went to the copy */
+	    continue;
+	case CAPTURE_REQUEST:
+	    request = g_new0(ReplayRequest, 1);
+	    request->agent = g_hash_table_lookup(peers,
+					GUINT_TO_POINTER(entry.session));
+	    request->sent = entry.time;
+	    if (request->agent)
+		g_hash_table_insert(requests, GINT_TO_POINTER(entry.reqid),
+								request);
+	    else
+		g_free(request);
+	    break;
+	case CAPTURE_RESPONSE:
+	case CAPTURE_TIMEOUT:
+	    request = g_hash_table_lookup(requests,
+					GINT_TO_POINTER(entry.reqid));
+	    if (!request)
+		break;
+	    g_hash_table_remove(requests, GINT_TO_POINTER(entry.reqid));
+	    trip.rtt = MAX(entry.time - request->sent, 0);
+	    trip.lost = entry.kind == CAPTURE_TIMEOUT;
+	    g_array_append_val(replay_agent(request->agent)->trips, trip);
+	    (*num_trips)++;
+	    if (entry.pdu) {
+		learn_response(request->agent, entry.pdu);
+		entry.pdu = NULL;
+	    }
+	    g_free(request);
+	    break;
+	}
+	capture_entry_clear(&entry);
+    }
+    capture_close(capture);
+
+    /* requests that never got an answer, the capture was cut */
+    g_hash_table_foreach(requests, (GHFunc)g_free, NULL);
+    g_hash_table_destroy(requests);
+    g_hash_table_destroy(peers);
+    return length;
+}
+
+/*
+ * The answer to a request: the next value recorded for each OID, or
+ * noSuchObject if there is none.  NULL if the next trip was lost.
+ */
+static struct snmp_pdu *
+replay_response(const gchar *agent, struct snmp_pdu *pdu, gint64 *rtt)
+{
+    struct snmp_pdu *response;
+    struct variable_list *vars, *var;
+    ReplayAgent *ra;
+    ReplayTrip *trip;
+    ReplayOid *ro;
+    gchar *key;
+
+    g_mutex_lock(&replay_lock);
+    ra = replay_agent(agent);
+    *rtt = 0;
+    if (ra->trips->len) {
+	trip = &g_array_index(ra->trips, ReplayTrip, ra->next);
+	ra->next = (ra->next + 1) % ra->trips->len;
+	*rtt = trip->rtt;
+	if (trip->lost) {
+	    g_mutex_unlock(&replay_lock);
+	    return NULL;
+	}
+    }
+
+    response = snmp_pdu_create(SNMP_MSG_RESPONSE);
+    response->reqid = pdu->reqid;
+    for (vars = pdu->variables; vars; vars = vars->next_variable) {
+	key = oid_key(agent, vars->name, vars->name_length);
+	ro = g_hash_table_lookup(replay_oids, key);
+	g_free(key);
+	if (!ro) {
+	    snmp_pdu_add_variable(response, vars->name, vars->name_length,
+				  SNMP_NOSUCHOBJECT, NULL, 0);
+	    continue;
+	}
+	var = g_ptr_array_index(ro->vars, ro->next);
+	ro->next = (ro->next + 1) % ro->vars->len;
+	snmp_pdu_add_variable(response, var->name, var->name_length,
+			      var->type, var->val_len ? var->val.string : NULL,
+			      var->val_len);
+    }
+    g_mutex_unlock(&replay_lock);
+    return response;
+}
+
+
+/*
+ * The net-snmp single session API, as far as the engine uses it.  A
+ * session is only ever used by the shard that opened it.
+ */
+
+typedef struct {
+	gint64			due;		/* monotonic usec */
+	gint			reqid;
+	struct snmp_pdu		*pdu;		/* the request */
+	struct snmp_pdu		*response;	/* NULL if lost */
+	netsnmp_callback	callback;
+	void			*magic;
+} ReplayPending;
+
+typedef struct {
+	struct snmp_session	session;
+	gchar			*agent;		/* "peer:port" */
+	GSList			*pending;	/* ReplayPending */
+} ReplaySession;
+
+void *
+snmp_sess_open(struct snmp_session *in)
+{
+    ReplaySession *rs = g_new0(ReplaySession, 1);
+
+    rs->session = *in;
+    rs->session.peername = g_strdup(in->peername);
+    /* nothing else of the caller's is kept */
+    rs->session.community = NULL;
+    rs->session.community_len = 0;
+    rs->agent = g_strdup_printf("%s:%d", in->peername, in->remote_port);
+    return rs;
+}
+
+struct snmp_session *
+snmp_sess_session(void *sessp)
+{
+    return &((ReplaySession *)sessp)->session;
+}
+
+int
+snmp_sess_async_send(void *sessp, struct snmp_pdu *pdu,
+		     netsnmp_callback callback, void *cb_data)
+{
+    ReplaySession *rs = sessp;
+    ReplayPending *pending;
+    gint64 rtt;
+
+    pending = g_new0(ReplayPending, 1);
+    pending->reqid = g_atomic_int_add(&last_reqid, 1) + 1;
+    pdu->reqid = pending->reqid;
+    pending->pdu = pdu;
+    pending->callback = callback ? callback : rs->session.callback;
+    pending->magic = cb_data;
+    pending->response = replay_response(rs->agent, pdu, &rtt);
+    pending->due = g_get_monotonic_time() + (max_speed ? 0 : rtt);
+    rs->pending = g_slist_append(rs->pending, pending);
+    return pending->reqid;
+}
+
+int
+snmp_sess_select_info2(void *sessp, int *numfds, netsnmp_large_fd_set *fdset,
+		       struct timeval *timeout, int *block)
+{
+    ReplaySession *rs = sessp;
+    ReplayPending *pending;
+    GSList *list;
+    gint64 now, due = G_MAXINT64;
+
+    for (list = rs->pending; list; list = list->next) {
+	pending = list->data;
+	due = MIN(due, pending->due);
+    }
+    if (due == G_MAXINT64)
+	return 0;
+    now = g_get_monotonic_time();
+    due = MAX(due - now, 0);
+    timeout->tv_sec = due / G_USEC_PER_SEC;
+    timeout->tv_usec = due % G_USEC_PER_SEC;
+    *block = 0;
+    return 0;
+}
+
+int
+snmp_sess_read2(void *sessp, netsnmp_large_fd_set *fdset)
+{
+    return 0;
+}
+
+void
+snmp_sess_timeout(void *sessp)
+{
+    ReplaySession *rs = sessp;
+    ReplayPending *pending;
+    GSList *list, *next, *due = NULL;
+    gint64 now = g_get_monotonic_time();
+
+    /* the callbacks may send again, so take the due ones out first */
+    for (list = rs->pending; list; list = next) {
+	next = list->next;
+	pending = list->data;
+	if (pending->due > now)
+	    continue;
+	rs->pending = g_slist_remove_link(rs->pending, list);
+	due = g_slist_concat(due, list);
+    }
+    for (list = due; list; list = list->next) {
+	pending = list->data;
+	if (pending->response)
+	    pending->callback(RECEIVED_MESSAGE, &rs->session, pending->reqid,
+			      pending->response, pending->magic);
+	else
+	    pending->callback(TIMED_OUT, &rs->session, pending->reqid,
+			      pending->pdu, pending->magic);
+	if (pending->response)
+	    snmp_free_pdu(pending->response);
+	snmp_free_pdu(pending->pdu);
+	g_free(pending);
+    }
+    g_slist_free(due);
+}
+
+int
+snmp_sess_close(void *sessp)
+{
+    ReplaySession *rs = sessp;
+    ReplayPending *pending;
+    GSList *list;
+
+    /* like the library, without calling back */
+    for (list = rs->pending; list; list = list->next) {
+	pending = list->data;
+	if (pending->response)
+	    snmp_free_pdu(pending->response);
+	snmp_free_pdu(pending->pdu);
+	g_free(pending);
+    }
+    g_slist_free(rs->pending);
+    g_free(rs->session.peername);
+    g_free(rs->agent);
+    g_free(rs);
+    return 1;
+}
+
+
+typedef struct {
+	simple_session		*ss;
+	input_data		data;
+	gint			base;		/* in the sample store */
+} ReplayReader;
+
+static gint
+cmp_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+usage()
+{
+    fprintf(stderr,
+	"usage: replay_snmp [-m] [-i interval_ms] [-d seconds] [-t threads]\n"
+	"                   [-u tick_us] capture\n"
+	"  -m  answer at once instead of after the recorded round trip\n"
+	"  -i  poll at this interval instead of the recorded ones\n"
+	"  -d  run this long, default the length of the capture\n"
+	"  -t  SNMP worker threads\n"
+	"  -u  how often the results are fetched, like the GKrellM tick\n"
+	"  v3 sessions are replayed as v2c\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    GPtrArray *setups;
+    GHashTable *readers;
+    CaptureEntry *setup;
+    ReplayReader *reader;
+    sample_set *set;
+    SampleStore *samples;
+    GArray *latency;
+    GHashTableIter iter;
+    gint interval_ms = 0;
+    gint seconds = 0;
+    gint threads = 1;
+    gint tick_us = 1000;
+    gint num_trips = 0;
+    gint64 length, start, now, elapsed, interval, sum;
+    glong values = 0, polls = 0, errors = 0;
+    guint next_setup = 0;
+    gint opt, i;
+
+    while ((opt = getopt(argc, argv, "mi:d:t:u:")) != -1) {
+	switch (opt) {
+	case 'm': max_speed = TRUE; break;
+	case 'i': interval_ms = atoi(optarg); break;
+	case 'd': seconds = atoi(optarg); break;
+	case 't': threads = atoi(optarg); break;
+	case 'u': tick_us = atoi(optarg); break;
+	default: usage();
+	}
+    }
+    if (optind != argc - 1 || interval_ms < 0 || seconds < 0 || tick_us < 1)
+	usage();
+
+    replay_agents = g_hash_table_new(g_str_hash, g_str_equal);
+    replay_oids = g_hash_table_new(g_str_hash, g_str_equal);
+    replay_pdus = g_ptr_array_new();
+    setups = g_ptr_array_new();
+    length = load_capture(argv[optind], setups, &num_trips);
+    if (!setups->len) {
+	fprintf(stderr, "%s: no sessions in the capture\n", argv[optind]);
+	return 1;
+    }
+    if (!seconds)
+	seconds = MAX((length + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC, 1);
+
+    simpleSNMPinit();
+    simpleSNMPset_threads(threads);
+    samples = samples_new(MAX_OID_STR);
+    readers = g_hash_table_new(g_direct_hash, g_direct_equal);
+    latency = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+    printf("# %s: %u setups, %d exchanges with %u agents, %d s%s\n",
+	   argv[optind], setups->len, num_trips,
+	   g_hash_table_size(replay_agents), seconds,
+	   max_speed ? ", at full speed" : "");
+
+    start = g_get_monotonic_time();
+    do {
+	now = g_get_monotonic_time();
+	elapsed = now - start;
+
+	/* the sessions as they were set up, at full speed all at once */
+	while (next_setup < setups->len) {
+	    setup = g_ptr_array_index(setups, next_setup);
+	    if (!max_speed && setup->time > elapsed)
+		break;
+	    next_setup++;
+	    reader = g_hash_table_lookup(readers,
+					GUINT_TO_POINTER(setup->session));
+	    if (!reader) {
+		reader = g_new0(ReplayReader, 1);
+		reader->ss = simpleSNMPopen(setup->peername, setup->port,
+			setup->version == SNMP_VERSION_1 ? 1 : 2,
+			setup->version == SNMP_VERSION_3 ? "public"
+						: setup->community,
+			TRANSPORT_UDP, &reader->data);
+		reader->base = samples_alloc(samples);
+		samples_setup(samples, reader->base, 0, 0, 1);
+		g_hash_table_insert(readers,
+			GUINT_TO_POINTER(setup->session), reader);
+	    }
+	    interval = interval_ms ? (gint64)interval_ms * 1000
+							: setup->interval;
+	    simpleSNMPpoll(reader->ss, setup->oid_str, setup->refresh,
+			   setup->num_oid, interval);
+	}
+
+	g_usleep(tick_us);
+	values += simpleSNMPupdate();
+	now = g_get_monotonic_time();
+
+	g_hash_table_iter_init(&iter, readers);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&reader)) {
+	    if (!reader->data.new)
+		continue;
+	    reader->data.new = 0;
+	    if (reader->data.error) {
+		errors++;
+		g_free(reader->data.error);
+		reader->data.error = NULL;
+		continue;
+	    }
+	    polls++;
+	    simpleSNMPswap(&reader->data);
+	    set = INPUT_FRONT(&reader->data);
+	    /* the result was ready half a round trip after the sample */
+	    if (set->timestamp) {
+		elapsed = now - set->timestamp - set->rtt / 2;
+		g_array_append_val(latency, elapsed);
+	    }
+	    for (i = 0; i < set->num_sample; i++)
+		if (set->fresh & (1 << i))
+		    samples_push(samples, reader->base + i,
+				 set->sample_n[i],
+				 set->sample_time[i],
+				 set->kind[i] == SAMPLE_COUNTER32);
+	}
+	samples_compute(samples);
+    } while (now - start < (gint64)seconds * G_USEC_PER_SEC);
+
+    elapsed = now - start;
+    sum = 0;
+    for (i = 0; i < latency->len; i++)
+	sum += g_array_index(latency, gint64, i);
+    g_array_sort(latency, cmp_gint64);
+
+    printf("# polls/s  varbinds/s  errors  latency mean/us  p99/us\n");
+    printf("%9.0f  %10.0f  %6ld  %15.0f  %6ld\n",
+	   polls * (gdouble)G_USEC_PER_SEC / elapsed,
+	   values * (gdouble)G_USEC_PER_SEC / elapsed, errors,
+	   latency->len ? (gdouble)sum / latency->len : 0.0,
+	   latency->len ? (glong)g_array_index(latency, gint64,
+					latency->len * 99 / 100) : 0L);
+    return 0;
+}
@@ -0,0 +1,169 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+#include <string.h>
+
+#include "samples.h"
+
+
+SampleStore *
+samples_new(gint block)
+{
+    SampleStore *store;
+
+    store = g_new0(SampleStore, 1);
+    store->block = block;
+    return store;
+}
+
+static gpointer
+grow_column(gpointer column, gsize elem, gint old_size, gint size)
+{
+    column = g_realloc(column, size * elem);
+    memset((gchar *)column + old_size * elem, 0, (size - old_size) * elem);
+    return column;
+}
+
+static void
+grow(SampleStore *store, gint size)
+{
+    gint n = store->size;
+
+    store->raw_scale = grow_column(store->raw_scale, sizeof(gdouble), n, size);
+    store->delta_scale = grow_column(store->delta_scale, sizeof(gdouble), n, size);
+    store->rate_scale = grow_column(store->rate_scale, sizeof(gdouble), n, size);
+    store->wrap = grow_column(store->wrap, sizeof(gint64), n, size);
+    store->cur = grow_column(store->cur, sizeof(gint64), n, size);
+    store->prev = grow_column(store->prev, sizeof(gint64), n, size);
+    store->time = grow_column(store->time, sizeof(gint64), n, size);
+    store->prev_time = grow_column(store->prev_time, sizeof(gint64), n, size);
+    store->delta = grow_column(store->delta, sizeof(gdouble), n, size);
+    store->rate = grow_column(store->rate, sizeof(gdouble), n, size);
+    store->value = grow_column(store->value, sizeof(gdouble), n, size);
+    store->free = g_renew(gint, store->free, size / store->block);
+    store->size = size;
+}
+
+static void
+clear(SampleStore *store, gint base)
+{
+    gint n = store->block;
+
+    memset(store->raw_scale + base, 0, n * sizeof(gdouble));
+    memset(store->delta_scale + base, 0, n * sizeof(gdouble));
+    memset(store->rate_scale + base, 0, n * sizeof(gdouble));
+    memset(store->wrap + base, 0, n * sizeof(gint64));
+    memset(store->cur + base, 0, n * sizeof(gint64));
+    memset(store->prev + base, 0, n * sizeof(gint64));
+    memset(store->time + base, 0, n * sizeof(gint64));
+    memset(store->prev_time + base, 0, n * sizeof(gint64));
+    memset(store->delta + base, 0, n * sizeof(gdouble));
+    memset(store->rate + base, 0, n * sizeof(gdouble));
+    memset(store->value + base, 0, n * sizeof(gdouble));
+}
+
+/* A block of cleared slots, returns the first one */
+gint
+samples_alloc(SampleStore *store)
+{
+    gint base;
+
+    if (store->num_free > 0)
+	return store->free[--store->num_free];
+    if (store->len + store->block > store->size)
+	grow(store, MAX(2 * store->size, 64 * store->block));
+    base = store->len;
+    store->len += store->block;
+    return base;
+}
+
+void
+samples_free(SampleStore *store, gint base)
+{
+    /* free slots are computed as well, they just stay 0 */
+    clear(store, base);
+    store->free[store->num_free++] = base;
+}
+
+void
+samples_setup(SampleStore *store, gint base, gdouble raw_scale,
+	      gdouble delta_scale, gdouble rate_scale)
+{
+    gint i;
+
+    for (i = base; i < base + store->block; i++) {
+	store->raw_scale[i] = raw_scale;
+	store->delta_scale[i] = delta_scale;
+	store->rate_scale[i] = rate_scale;
+    }
+}
+
+/* A freshly fetched value, the current one becomes the previous */
+void
+samples_push(SampleStore *store, gint slot, gint64 value, gint64 time,
+	     gboolean counter32)
+{
+    store->prev[slot] = store->cur[slot];
+    store->prev_time[slot] = store->time[slot];
+    store->cur[slot] = value;
+    store->time[slot] = time;
+    store->wrap[slot] = counter32 ? G_GINT64_CONSTANT(1) << 32 : 0;
+}
+
+void
+samples_compute(SampleStore *store)
+{
+    const gdouble *restrict raw_scale = store->raw_scale;
+    const gdouble *restrict delta_scale = store->delta_scale;
+    const gdouble *restrict rate_scale = store->rate_scale;
+    const gint64 *restrict wrap = store->wrap;
+    const gint64 *restrict cur = store->cur;
+    const gint64 *restrict prev = store->prev;
+    const gint64 *restrict time = store->time;
+    const gint64 *restrict prev_time = store->prev_time;
+    gdouble *restrict delta = store->delta;
+    gdouble *restrict rate = store->rate;
+    gdouble *restrict value = store->value;
+    gint64 d, dt;
+    gint i, n = store->len;
+
+    for (i = 0; i < n; i++) {
+	d = cur[i] - prev[i];
+	/* a Counter32 going backwards has wrapped */
+	d += wrap[i] & -(gint64)(d < 0);
+	dt = time[i] - prev_time[i];
+	delta[i] = d;
+	rate[i] = dt > 0 ? d * (gdouble)G_USEC_PER_SEC / dt : 0;
+	value[i] = raw_scale[i] * cur[i] + delta_scale[i] * delta[i]
+					  + rate_scale[i] * rate[i];
+    }
+}
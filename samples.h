@@ -0,0 +1,77 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+
+#include <glib.h>
+
+
+/*
+ * The samples of all readers, in one store of columns: the current and
+ * the previous raw value of each OID and when they were fetched.  Each
+ * reader owns a block of slots.  Once per tick samples_compute() derives
+ * the delta, the rate and the value to chart of every slot in one pass
+ * without branches, which the compiler turns into SIMD code, and the
+ * labels, tooltips, charts and expressions read the results from there.
+ */
+
+typedef struct SampleStore SampleStore;
+
+struct SampleStore {
+	gint			block;		/* slots per reader */
+	gint			len;		/* slots handed out so far */
+	gint			size;		/* slots allocated */
+	gint			*free;		/* bases of blocks given back */
+	gint			num_free;
+	/* how a slot is charted, value = raw * cur + delta * d + rate * r */
+	gdouble			*raw_scale;
+	gdouble			*delta_scale;
+	gdouble			*rate_scale;
+	gint64			*wrap;		/* 2^32 for Counter32, else 0 */
+	/* the samples, times are monotonic usec, 0 if none */
+	gint64			*cur;
+	gint64			*prev;
+	gint64			*time;
+	gint64			*prev_time;
+	/* computed by samples_compute() */
+	gdouble			*delta;
+	gdouble			*rate;		/* per second, 0 w/o interval */
+	gdouble			*value;
+};
+
+extern	SampleStore *samples_new(gint block);
+extern	gint samples_alloc(SampleStore *store);
+extern	void samples_free(SampleStore *store, gint base);
+extern	void samples_setup(SampleStore *store, gint base, gdouble raw_scale,
+				gdouble delta_scale, gdouble rate_scale);
+extern	void samples_push(SampleStore *store, gint slot, gint64 value,
+				gint64 time, gboolean counter32);
+extern	void samples_compute(SampleStore *store);
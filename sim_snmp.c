@@ -0,0 +1,587 @@
+/* SNMP reader plugin for GKrellM.
+|  Copyright (C) 2000-2020  Christian W. Zuckschwerdt <zany@triq.net>
+|
+|  Author:  Christian W. Zuckschwerdt  <zany@triq.net>  http://triq.net/
+|  Latest versions might be found at:  http://gkrellm.net/
+|
+| GKrellM_SNMP is free software; you can redistribute it and/or
+| modify it under the terms of the GNU General Public License as
+| published by the Free Software Foundation; either version 2 of
+| the License, or (at your option) any later version.
+|
+| In addition, as a special exception, the copyright holders give
+| permission to link the code of this program with the OpenSSL library,
+| and distribute linked combinations including the two.
+| You must obey the GNU General Public License in all respects
+| for all of the code used other than OpenSSL.  If you modify
+| file(s) with this exception, you may extend this exception to your
+| version of the file(s), but you are not obligated to do so.  If you
+| do not wish to do so, delete this exception statement from your
+| version.  If you delete this exception statement from all source
+| files in the program, then also delete it here.
+
+| This program is distributed in the hope that it will be useful,
+| but WITHOUT ANY WARRANTY; without even the implied warranty of
+| MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+| GNU General Public License for more details.
+
+| You should have received a copy of the GNU General Public License
+| along with GKrellM_SNMP. If not, see <http://www.gnu.org/>.
+*/
+
+
+/*
+ * Simulation of the SNMP engine against made-up agents, on a virtual
+ * clock.  The net-snmp session functions the engine uses are replaced
+ * at link time by the ones below, which answer after a round trip time
+ * with jitter (so responses get reordered), lose requests, and serve
+ * counters with known rates, Counter32 ones close to wrapping.  The
+ * engine runs without worker threads (simpleSNMPsimulate()), the clock
+ * jumps from one event to the next, so hours of polling take seconds.
+ *
+ * Reported are the fairness of the scheduler over the sessions, the
+ * polls in flight and the age of the results handed to the GTK thread
+ * (backpressure), and how far the rates computed by the sample store
+ * are off the true ones.  The exit status is 1 if any rate was wrong
+ * or a reader saw its samples go back in time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#define RECEIVED_MESSAGE NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE
+#define TIMED_OUT NETSNMP_CALLBACK_OP_TIMED_OUT
+
+#include <simpleSNMP.h>
+#include <samples.h>
+
+
+/* The counters of an agent, net-snmp's experimental subtree */
+#define SIM_OID		".1.3.6.1.4.1.8072.9999.9999"
+#define SIM_COUNTER32	1
+#define SIM_COUNTER64	2
+
+static oid sim_oid[] = { 1, 3, 6, 1, 4, 1, 8072, 9999, 9999 };
+static oid sim_uptime[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+
+typedef struct {
+	gint64			boot;		/* virtual usec */
+	gint64			start32;	/* the counters at boot */
+	gint64			start64;
+	gdouble			rate32;		/* per second */
+	gdouble			rate64;
+} SimAgent;
+
+/* the network */
+static gint64 sim_rtt = 20000;		/* usec */
+static gint64 sim_jitter = 10000;	/* usec, added 0 .. jitter */
+static gint64 sim_timeout = 1000000;	/* usec, until a loss is noticed */
+static gdouble sim_loss;		/* 0 .. 1 */
+
+static gint64 sim_now = G_USEC_PER_SEC;
+static GRand *sim_rand;
+static SimAgent *sim_agents;
+static gint sim_num_agents;
+static gint sim_port = 1161;		/* of the first agent */
+static gint last_reqid;
+
+static gint64
+sim_clock(void)
+{
+    return sim_now;
+}
+
+static gint64
+sim_counter(SimAgent *agent, gint which, gint64 time)
+{
+    gdouble up = (time - agent->boot) / (gdouble)G_USEC_PER_SEC;
+
+    if (which == SIM_COUNTER32)
+	return (agent->start32 + (gint64)(agent->rate32 * up)) & 0xffffffff;
+    return agent->start64 + (gint64)(agent->rate64 * up);
+}
+
+/* The agent's answer, sampled at time */
+static struct snmp_pdu *
+sim_response(SimAgent *agent, struct snmp_pdu *pdu, gint64 time)
+{
+    struct snmp_pdu *response;
+    struct variable_list *vars;
+    struct counter64 c64;
+    u_long n;
+    gint64 v;
+    gint which;
+
+    response = snmp_pdu_create(SNMP_MSG_RESPONSE);
+    response->reqid = pdu->reqid;
+    for (vars = pdu->variables; vars; vars = vars->next_variable) {
+	which = 0;
+	if (vars->name_length == G_N_ELEMENTS(sim_oid) + 2
+		&& !memcmp(vars->name, sim_oid, sizeof(sim_oid)))
+	    which = vars->name[G_N_ELEMENTS(sim_oid)];
+
+	if (vars->name_length == G_N_ELEMENTS(sim_uptime)
+		&& !memcmp(vars->name, sim_uptime, sizeof(sim_uptime))) {
+	    n = (time - agent->boot) / 10000;
+	    snmp_pdu_add_variable(response, vars->name, vars->name_length,
+				  ASN_TIMETICKS, (u_char *)&n, sizeof(n));
+	} else if (which == SIM_COUNTER32) {
+	    n = sim_counter(agent, which, time);
+	    snmp_pdu_add_variable(response, vars->name, vars->name_length,
+				  ASN_COUNTER, (u_char *)&n, sizeof(n));
+	} else if (which == SIM_COUNTER64) {
+	    v = sim_counter(agent, which, time);
+	    c64.high = (guint64)v >> 32;
+	    c64.low = v & 0xffffffff;
+	    snmp_pdu_add_variable(response, vars->name, vars->name_length,
+				  ASN_COUNTER64, (u_char *)&c64, sizeof(c64));
+	} else {
+	    snmp_pdu_add_variable(response, vars->name, vars->name_length,
+				  SNMP_NOSUCHOBJECT, NULL, 0);
+	}
+    }
+    return response;
+}
+
+
+/*
+ * The net-snmp single session API, as far as the engine uses it.
+ */
+
+typedef struct {
+	gint64			due;		/* virtual usec */
+	gint			reqid;
+	struct snmp_pdu		*pdu;		/* the request */
+	struct snmp_pdu		*response;	/* NULL if lost */
+	netsnmp_callback	callback;
+	void			*magic;
+} SimPending;
+
+typedef struct {
+	struct snmp_session	session;
+	SimAgent		*agent;
+	GSList			*pending;	/* SimPending */
+	gint			num_pending;
+	/* what the scheduler did */
+	glong			sends;
+	gint64			last_send;
+	gint64			max_gap;	/* between sends, usec */
+	gint			max_pending;
+} SimSession;
+
+static GPtrArray *sim_sessions;
+
+void *
+snmp_sess_open(struct snmp_session *in)
+{
+    SimSession *rs;
+    gint a = in->remote_port - sim_port;
+
+    if (a < 0 || a >= sim_num_agents)
+	return NULL;
+    rs = g_new0(SimSession, 1);
+    rs->session = *in;
+    rs->session.peername = NULL;
+    rs->session.community = NULL;
+    rs->session.community_len = 0;
+    rs->agent = &sim_agents[a];
+    g_ptr_array_add(sim_sessions, rs);
+    return rs;
+}
+
+struct snmp_session *
+snmp_sess_session(void *sessp)
+{
+    return &((SimSession *)sessp)->session;
+}
+
+int
+snmp_sess_async_send(void *sessp, struct snmp_pdu *pdu,
+		     netsnmp_callback callback, void *cb_data)
+{
+    SimSession *rs = sessp;
+    SimPending *pending;
+    gint64 rtt;
+
+    if (rs->last_send)
+	rs->max_gap = MAX(rs->max_gap, sim_now - rs->last_send);
+    rs->last_send = sim_now;
+    rs->sends++;
+
+    pending = g_new0(SimPending, 1);
+    pending->reqid = ++last_reqid;
+    pdu->reqid = pending->reqid;
+    pending->pdu = pdu;
+    pending->callback = callback ? callback : rs->session.callback;
+    pending->magic = cb_data;
+    if (g_rand_double(sim_rand) < sim_loss) {
+	pending->due = sim_now + sim_timeout;
+    } else {
+	rtt = sim_rtt + (sim_jitter ? g_rand_int_range(sim_rand, 0,
+						(gint32)sim_jitter + 1) : 0);
+	pending->due = sim_now + rtt;
+	/* halfway, as the engine assumes */
+	pending->response = sim_response(rs->agent, pdu,
+					 pending->due - rtt / 2);
+    }
+    rs->pending = g_slist_prepend(rs->pending, pending);
+    rs->num_pending++;
+    rs->max_pending = MAX(rs->max_pending, rs->num_pending);
+    return pending->reqid;
+}
+
+int
+snmp_sess_select_info2(void *sessp, int *numfds, netsnmp_large_fd_set *fdset,
+		       struct timeval *timeout, int *block)
+{
+    SimSession *rs = sessp;
+    SimPending *pending;
+    GSList *list;
+    gint64 due = G_MAXINT64;
+
+    for (list = rs->pending; list; list = list->next) {
+	pending = list->data;
+	due = MIN(due, pending->due);
+    }
+    if (due == G_MAXINT64)
+	return 0;
+    due = MAX(due - sim_now, 0);
+    timeout->tv_sec = due / G_USEC_PER_SEC;
+    timeout->tv_usec = due % G_USEC_PER_SEC;
+    *block = 0;
+    return 0;
+}
+
+int
+snmp_sess_read2(void *sessp, netsnmp_large_fd_set *fdset)
+{
+    return 0;
+}
+
+static gint
+cmp_pending(gconstpointer a, gconstpointer b)
+{
+    const SimPending *x = a, *y = b;
+
+    if (x->due != y->due)
+	return x->due < y->due ? -1 : 1;
+    return x->reqid - y->reqid;
+}
+
+void
+snmp_sess_timeout(void *sessp)
+{
+    SimSession *rs = sessp;
+    SimPending *pending;
+    GSList *list, *next, *due = NULL;
+
+    /* arriving in the order of their round trips, not as sent */
+    for (list = rs->pending; list; list = next) {
+	next = list->next;
+	pending = list->data;
+	if (pending->due > sim_now)
+	    continue;
+	rs->pending = g_slist_remove_link(rs->pending, list);
+	rs->num_pending--;
+	due = g_slist_insert_sorted(due, pending, cmp_pending);
+	g_slist_free_1(list);
+    }
+    for (list = due; list; list = list->next) {
+	pending = list->data;
+	if (pending->response)
+	    pending->callback(RECEIVED_MESSAGE, &rs->session, pending->reqid,
+			      pending->response, pending->magic);
+	else
+	    pending->callback(TIMED_OUT, &rs->session, pending->reqid,
+			      pending->pdu, pending->magic);
+	if (pending->response)
+	    snmp_free_pdu(pending->response);
+	snmp_free_pdu(pending->pdu);
+	g_free(pending);
+    }
+    g_slist_free(due);
+}
+
+int
+snmp_sess_close(void *sessp)
+{
+    SimSession *rs = sessp;
+    SimPending *pending;
+    GSList *list, *pending_list;
+
+    /* like the library (5.7 on), what is in flight times out */
+    pending_list = rs->pending;
+    rs->pending = NULL;
+    rs->num_pending = 0;
+    g_ptr_array_remove(sim_sessions, rs);
+    for (list = pending_list; list; list = list->next) {
+	pending = list->data;
+	pending->callback(TIMED_OUT, &rs->session, pending->reqid,
+			  pending->pdu, pending->magic);
+	if (pending->response)
+	    snmp_free_pdu(pending->response);
+	snmp_free_pdu(pending->pdu);
+	g_free(pending);
+    }
+    g_slist_free(pending_list);
+    g_free(rs);
+    return 1;
+}
+
+
+/* A reader on the GTK side */
+typedef struct {
+	simple_session		*ss;
+	input_data		data;
+	SimAgent		*agent;
+	gint			base;		/* in the sample store */
+	gint64			last;		/* timestamp seen last */
+	gint64			max_gap;	/* between timestamps, usec */
+	glong			results;	/* without an error */
+	guint			pushed;		/* samples with a delta */
+} SimReader;
+
+static void
+usage()
+{
+    fprintf(stderr,
+	"usage: sim_snmp [-a agents] [-n sessions] [-i interval_ms] [-d seconds]\n"
+	"                [-r rtt_ms] [-j jitter_ms] [-l loss_%%] [-T timeout_ms]\n"
+	"                [-p pipeline] [-g tick_ms] [-t shards] [-s seed]\n"
+	"                [-R pdus_per_s]\n"
+	"  the times are virtual, -g is how often GKrellM takes the results,\n"
+	"  -R limits the requests per agent\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    gchar *oids[] = { SIM_OID ".1.0", SIM_OID ".2.0" };
+    gint agents = 16;
+    gint sessions = 256;
+    gint interval_ms = 1000;
+    gint seconds = 3600;
+    gint depth = 1;
+    gint tick_ms = 100;
+    gint shards = 1;
+    guint32 seed = 1;
+    gdouble rate = 0;
+    SimReader *readers, *reader;
+    sample_set *set;
+    SimSession *rs;
+    SampleStore *samples;
+    gint64 start, end, interval, next, next_tick, age, max_age = 0;
+    gint64 gap, max_gap = 0, wall;
+    gdouble expected, polls, sum = 0, sum2 = 0, err, max_err = 0;
+    gdouble true_rate;
+    glong seen = 0, errors = 0, checked = 0, wrong = 0, backwards = 0;
+    glong wraps = 0, skipped = 0, delivered, age_n = 0, deferred = 0;
+    glong sends = 0;
+    gdouble age_sum = 0;
+    gint max_pending = 0;
+    gint opt, i, k, slot;
+
+    while ((opt = getopt(argc, argv, "a:n:i:d:r:j:l:T:p:g:t:s:R:")) != -1) {
+	switch (opt) {
+	case 'a': agents = atoi(optarg); break;
+	case 'n': sessions = atoi(optarg); break;
+	case 'i': interval_ms = atoi(optarg); break;
+	case 'd': seconds = atoi(optarg); break;
+	case 'r': sim_rtt = atoi(optarg) * (gint64)1000; break;
+	case 'j': sim_jitter = atoi(optarg) * (gint64)1000; break;
+	case 'l': sim_loss = atof(optarg) / 100; break;
+	case 'T': sim_timeout = atoi(optarg) * (gint64)1000; break;
+	case 'p': depth = atoi(optarg); break;
+	case 'g': tick_ms = atoi(optarg); break;
+	case 't': shards = atoi(optarg); break;
+	case 's': seed = strtoul(optarg, NULL, 0); break;
+	case 'R': rate = atof(optarg); break;
+	default: usage();
+	}
+    }
+    if (agents < 1 || sessions < 1 || interval_ms < 1 || seconds < 1
+	    || tick_ms < 1 || sim_rtt < 0 || sim_jitter < 0 || rate < 0)
+	usage();
+    interval = interval_ms * (gint64)1000;
+
+    sim_rand = g_rand_new_with_seed(seed);
+    sim_sessions = g_ptr_array_new();
+    sim_num_agents = agents;
+    sim_agents = g_new0(SimAgent, agents);
+    for (i = 0; i < agents; i++) {
+	sim_agents[i].boot = -g_rand_int_range(sim_rand, 0, 1000000)
+						* (gint64)G_USEC_PER_SEC;
+	/* up to 1 Gbit/s, the Counter32 wraps within 5 minutes */
+	sim_agents[i].rate32 = g_rand_double_range(sim_rand, 1e6, 125e6);
+	sim_agents[i].rate64 = g_rand_double_range(sim_rand, 1e6, 125e7);
+	sim_agents[i].start32 = (G_GINT64_CONSTANT(1) << 32)
+	    - (gint64)(sim_agents[i].rate32 * g_rand_double_range(sim_rand,
+							0, 300))
+	    - (gint64)(sim_agents[i].rate32
+				* (-sim_agents[i].boot / G_USEC_PER_SEC));
+	sim_agents[i].start64 = g_rand_int(sim_rand);
+    }
+
+    simpleSNMPsimulate(sim_clock);
+    simpleSNMPinit();
+    simpleSNMPset_threads(shards);
+    simpleSNMPset_pipeline(depth);
+    simpleSNMPset_rate(NULL, 0, rate);
+    samples = samples_new(MAX_OID_STR);
+
+    readers = g_new0(SimReader, sessions);
+    for (i = 0; i < sessions; i++) {
+	reader = &readers[i];
+	reader->agent = &sim_agents[i % agents];
+	reader->ss = simpleSNMPopen("sim", sim_port + i % agents, 2,
+				    "public", TRANSPORT_UDP, &reader->data);
+	simpleSNMPpoll(reader->ss, oids, NULL, G_N_ELEMENTS(oids), interval);
+	reader->base = samples_alloc(samples);
+	samples_setup(samples, reader->base, 0, 0, 1);
+    }
+
+    printf("# %d sessions on %d agents every %d ms, rtt %lld+%lld ms, "
+	   "%.1f%% lost, pipeline %d, %d s\n", sessions, agents, interval_ms,
+	   (long long)sim_rtt / 1000, (long long)sim_jitter / 1000,
+	   sim_loss * 100, depth, seconds);
+
+    wall = g_get_monotonic_time();
+    start = sim_now;
+    end = start + seconds * (gint64)G_USEC_PER_SEC;
+    next_tick = start;
+    while (sim_now < end) {
+	next = simpleSNMPstep();
+	if (sim_now < next_tick) {
+	    sim_now = MIN(MIN(next, next_tick), end);
+	    continue;
+	}
+
+	/* a GKrellM tick */
+	next_tick += tick_ms * (gint64)1000;
+	simpleSNMPupdate();
+	for (i = 0; i < sessions; i++) {
+	    reader = &readers[i];
+	    if (!reader->data.new)
+		continue;
+	    reader->data.new = 0;
+	    seen++;
+	    if (reader->data.error) {
+		errors++;
+		g_free(reader->data.error);
+		reader->data.error = NULL;
+		continue;
+	    }
+	    simpleSNMPswap(&reader->data);
+	    set = INPUT_FRONT(&reader->data);
+	    deferred += set->deferred;
+	    if (set->timestamp <= reader->last)
+		backwards++;
+	    if (reader->last)
+		reader->max_gap = MAX(reader->max_gap,
+				      set->timestamp - reader->last);
+	    reader->last = set->timestamp;
+	    reader->results++;
+	    age = sim_now - set->timestamp - set->rtt / 2;
+	    max_age = MAX(max_age, age);
+	    age_sum += age;
+	    age_n++;
+	    for (k = 0; k < set->num_sample; k++) {
+		if (!(set->fresh & (1 << k)))
+		    continue;
+		slot = reader->base + k;
+		if (k == 0 && set->sample_n[k] < samples->cur[slot])
+		    wraps++;
+		samples_push(samples, slot, set->sample_n[k],
+			     set->sample_time[k],
+			     set->kind[k] == SAMPLE_COUNTER32);
+		if (samples->prev_time[slot])
+		    reader->pushed |= 1 << k;
+	    }
+	}
+	samples_compute(samples);
+
+	/* each delta should be within a count of the true one */
+	for (i = 0; i < sessions; i++) {
+	    reader = &readers[i];
+	    for (k = 0; k < 2; k++) {
+		if (!(reader->pushed & (1 << k)))
+		    continue;
+		slot = reader->base + k;
+		true_rate = k == 0 ? reader->agent->rate32
+				   : reader->agent->rate64;
+		err = samples->delta[slot] - true_rate
+			* (samples->time[slot] - samples->prev_time[slot])
+			/ G_USEC_PER_SEC;
+		if (ABS(err) > 1.5)
+		    wrong++;
+		err = ABS(samples->rate[slot] - true_rate) / true_rate;
+		max_err = MAX(max_err, err);
+		checked++;
+	    }
+	    reader->pushed = 0;
+	}
+    }
+    wall = g_get_monotonic_time() - wall;
+
+    /*
+     * Jain's fairness index over the results per reader.  Readers of the
+     * same OIDs share the requests, so it is the readers that count.
+     */
+    expected = (gdouble)(end - start) / interval;
+    delivered = 0;
+    for (i = 0; i < sessions; i++) {
+	reader = &readers[i];
+	polls = reader->results / expected;
+	sum += polls;
+	sum2 += polls * polls;
+	delivered += reader->results;
+	gap = reader->max_gap - interval;
+	max_gap = MAX(max_gap, gap);
+	skipped += MAX((glong)(expected + 0.5) - reader->results, 0);
+    }
+    for (i = 0; i < sim_sessions->len; i++) {
+	rs = g_ptr_array_index(sim_sessions, i);
+	sends += rs->sends;
+	max_pending = MAX(max_pending, rs->max_pending);
+    }
+
+    printf("polls        %ld of %.0f due, %ld skipped\n",
+	   delivered, expected * sessions, skipped);
+    printf("fairness     %.6f (Jain's index of the polls per reader)\n",
+	   sum2 ? sum * sum / (sessions * sum2) : 0.0);
+    printf("requests     %ld, %.3f per poll due\n",
+	   sends, sends / (expected * sessions));
+    printf("late         %.1f ms at most\n", max_gap / 1000.0);
+    printf("in flight    %d at most per session\n", max_pending);
+    printf("handed over  %ld results, %ld errors, age mean %.1f ms, "
+	   "max %.1f ms\n", seen, errors,
+	   age_n ? age_sum / age_n / 1000 : 0.0, max_age / 1000.0);
+    printf("rates        %ld checked, %ld wrong, %ld wraps, "
+	   "error at most %.2g\n", checked, wrong, wraps, max_err);
+    printf("order        %ld samples back in time\n", backwards);
+    printf("throttled    %ld polls held back by the rate, ratio %.3f\n",
+	   deferred, deferred ? (gdouble)deferred / (seen - errors + deferred)
+			      : 0.0);
+    printf("speed        %.0f polls/s\n",
+	   wall ? delivered * (gdouble)G_USEC_PER_SEC / wall : 0.0);
+
+    /* close them all with polls in flight, their callbacks time out */
+    for (i = 0; i < sessions; i++)
+	simpleSNMPclose(readers[i].ss);
+    for (k = 0; k < 10 && sim_sessions->len > 0; k++) {
+	simpleSNMPstep();
+	simpleSNMPupdate();
+    }
+    simpleSNMPupdate();
+    printf("closed       %d sessions, %d still open\n",
+	   sessions, sim_sessions->len);
+    for (i = 0; i < sessions; i++)
+	simpleSNMPfree_data(&readers[i].data);
+
+    return wrong || backwards || sim_sessions->len ? 1 : 0;
+}
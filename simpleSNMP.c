@@ -35,18 +35,6 @@
 
 #include <stdio.h>
 
-#ifdef UCDSNMP
-#include <ucd-snmp/asn1.h>
-#include <ucd-snmp/mib.h>
-#include <ucd-snmp/parse.h>
-#include <ucd-snmp/snmp.h>
-#include <ucd-snmp/snmp_api.h>
-#include <ucd-snmp/snmp_client.h>
-#include <ucd-snmp/snmp_impl.h> /* special ASN types */
-#ifdef DEBUG_SNMP
-#include <ucd-snmp/snmp_debug.h>
-#endif /* DEBUG_SNMP */
-#else /* UCDSNMP */
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
 #define RECEIVED_MESSAGE NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE
@@ -54,14 +42,14 @@
 #ifdef DEBUG_SNMP
 #include <net-snmp/snmp_debug.h>
 #endif /* DEBUG_SNMP */
-#endif /* UCDSNMP */
 
 #include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <simpleSNMP.h>
-
-
-/* #define STREAM *//* test for Lou Cephyr */
+#include <capture.h>
 
 
 static gchar *
@@ -76,51 +64,216 @@ strdup_uptime (glong time)
     return g_strdup_printf ("%dd %d:%d", up_d, up_h, up_m );
 }
 
-#ifdef UCDSNMP_PRE_4_2
+/* net-snmp picks the transport by the prefix of the peer name */
+static gchar *
+transport_peername(gchar *peername, gint transport)
+{
+    if (transport == TRANSPORT_TCP && !g_str_has_prefix(peername, "tcp:"))
+	return g_strdup_printf("tcp:%s", peername);
+    return g_strdup(peername);
+}
+
+/* The agent behind a peer name, whatever the transport */
+static gchar *
+agent_peername(gchar *peername)
+{
+    if (g_str_has_prefix(peername, "tcp:") || g_str_has_prefix(peername, "udp:"))
+	return peername + 4;
+    return peername;
+}
 
 /*
- * snmp_parse_args.c
+ * SNMPv3 (USM).  Discovering the engine ID of an agent takes a round trip,
+ * and turning a passphrase into a key a million rounds of hashing.  So the
+ * engine IDs and the keys, plain and localized to each engine, are kept
+ * for the lifetime of the plugin and shared by all sessions and shards.
+ * A reopened or reconfigured reader starts without any of that work.
  */
 
-static oid
-*snmp_parse_oid(const char *argv,
-		oid *root,
-		size_t *rootlen)
-{
-  size_t savlen = *rootlen;
-  /* printf("parse_oid: read_objid\n"); */
-  if (read_objid(argv,root,rootlen)) {
-    return root;
-  }
-  *rootlen = savlen;
-  /* printf("parse_oid: get_node\n"); */
-  if (get_node(argv,root,rootlen)) {
-    return root;
-  }
-  *rootlen = savlen;
-  /* printf("parse_oid: wildly parsing\n"); */
-  if (get_wild_node(argv,root,rootlen)) {
-    return root;
-  }
-  return NULL;
-}
-
-#endif /* UCDSNMP_PRE_4_2 */
+typedef struct usm_key usm_key;
 
-void
-simpleSNMPinit()
+struct usm_key {
+	u_char			key[USM_AUTH_KU_LEN];
+	size_t			len;
+};
+
+typedef struct usm_engine usm_engine;
+
+struct usm_engine {
+	u_char			*id;
+	size_t			id_len;
+	GHashTable		*keys;		/* localized, by passphrase */
+};
+
+/*
+ * Also serializes the library's (global) USM user list and engine times,
+ * which every v3 PDU sent or received goes through.  Recursive, as a
+ * response may be split and sent again from within the read.
+ */
+static GRecMutex usm_lock;
+static GHashTable *usm_engines;		/* by "peer:port" */
+static GHashTable *usm_passphrases;	/* plain keys, by passphrase */
+
+static usm_key *
+usm_passphrase(gchar *pass)
 {
+    usm_key *ku;
+
+    ku = g_hash_table_lookup(usm_passphrases, pass);
+    if (ku)
+	return ku;
+    ku = g_new0(usm_key, 1);
+    ku->len = sizeof(ku->key);
+    if (generate_Ku(usmHMACSHA1AuthProtocol, USM_AUTH_PROTO_SHA_LEN,
+		    (u_char *)pass, strlen(pass), ku->key, &ku->len)
+							!= SNMPERR_SUCCESS) {
+	/* too short, most likely */
+	g_free(ku);
+	return NULL;
+    }
+    g_hash_table_insert(usm_passphrases, g_strdup(pass), ku);
+    return ku;
+}
 
-#ifdef DEBUG_SNMP
-    debug_register_tokens("all");
-    snmp_set_do_debugging(1);
-#endif /* DEBUG_SNMP */
+static usm_key *
+usm_localized(usm_engine *engine, gchar *pass)
+{
+    usm_key *ku, *kul;
+
+    kul = g_hash_table_lookup(engine->keys, pass);
+    if (kul)
+	return kul;
+    ku = usm_passphrase(pass);
+    if (!ku)
+	return NULL;
+    kul = g_new0(usm_key, 1);
+    kul->len = sizeof(kul->key);
+    if (generate_kul(usmHMACSHA1AuthProtocol, USM_AUTH_PROTO_SHA_LEN,
+		     engine->id, engine->id_len, ku->key, ku->len,
+		     kul->key, &kul->len) != SNMPERR_SUCCESS) {
+	g_free(kul);
+	return NULL;
+    }
+    g_hash_table_insert(engine->keys, g_strdup(pass), kul);
+    return kul;
+}
+
+/*
+ * Fill in the keys of a v3 session.  If the engine of the agent is known,
+ * they are localized already and the library skips the discovery.  The
+ * caller holds usm_lock, the keys stay valid for good.
+ */
+static gchar *
+usm_keys(struct snmp_session *session, gchar *agent, gchar *auth, gchar *priv)
+{
+    usm_engine *engine = NULL;
+    usm_key *key;
+
+    if (agent)
+	engine = g_hash_table_lookup(usm_engines, agent);
+    if (engine) {
+	session->securityEngineID = engine->id;
+	session->securityEngineIDLen = engine->id_len;
+    }
+    if (auth) {
+	key = engine ? usm_localized(engine, auth) : usm_passphrase(auth);
+	if (!key)
+	    return g_strdup_printf("Error! Bad v3 auth passphrase.");
+	if (engine) {
+	    session->securityAuthLocalKey = key->key;
+	    session->securityAuthLocalKeyLen = key->len;
+	} else {
+	    memcpy(session->securityAuthKey, key->key, key->len);
+	    session->securityAuthKeyLen = key->len;
+	}
+    }
+    if (priv) {
+	key = engine ? usm_localized(engine, priv) : usm_passphrase(priv);
+	if (!key)
+	    return g_strdup_printf("Error! Bad v3 priv passphrase.");
+	if (engine) {
+	    session->securityPrivLocalKey = key->key;
+	    session->securityPrivLocalKeyLen = key->len;
+	} else {
+	    memcpy(session->securityPrivKey, key->key, key->len);
+	    session->securityPrivKeyLen = key->len;
+	}
+    }
+    return NULL;
+}
+
+/* Remember the engine the library discovered when opening sessp */
+static void
+usm_learn(gchar *agent, void *sessp)
+{
+    struct snmp_session *session = snmp_sess_session(sessp);
+    usm_engine *engine;
+
+    if (session->version != SNMP_VERSION_3 || !session->securityEngineIDLen
+	    || g_hash_table_lookup(usm_engines, agent))
+	return;
+    engine = g_new0(usm_engine, 1);
+    engine->id = g_memdup2(session->securityEngineID,
+			   session->securityEngineIDLen);
+    engine->id_len = session->securityEngineIDLen;
+    engine->keys = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(usm_engines, g_strdup(agent), engine);
+}
+
+/*
+ * Set up the version and the credentials of a session.  For v3 the
+ * community is "user", "user:authpass" or "user:authpass:privpass", for
+ * noAuthNoPriv, authNoPriv (SHA) and authPriv (SHA, AES).  The pass-
+ * phrases are handed back, the keys are made from them when opening.
+ */
+static void
+session_security(struct snmp_session *session, gint vers, gchar *community,
+		 gchar **auth, gchar **priv)
+{
+    gchar **cred;
+
+    *auth = NULL;
+    *priv = NULL;
+    session->community = (guchar *)g_strdup(community);
+    session->community_len = strlen(community);
+    if (vers != 3) {
+	session->version = vers == 2 ? SNMP_VERSION_2c : SNMP_VERSION_1;
+	return;
+    }
+
+    cred = g_strsplit(community, ":", 3);
+    session->version = SNMP_VERSION_3;
+    session->securityModel = USM_SEC_MODEL_NUMBER;
+    session->securityName = g_strdup(cred[0] ? cred[0] : "");
+    session->securityNameLen = strlen(session->securityName);
+    session->securityLevel = SNMP_SEC_LEVEL_NOAUTH;
+    if (cred[0] && cred[1]) {
+	session->securityLevel = SNMP_SEC_LEVEL_AUTHNOPRIV;
+	session->securityAuthProto = usmHMACSHA1AuthProtocol;
+	session->securityAuthProtoLen = USM_AUTH_PROTO_SHA_LEN;
+	*auth = g_strdup(cred[1]);
+	if (cred[2]) {
+	    session->securityLevel = SNMP_SEC_LEVEL_AUTHPRIV;
+	    session->securityPrivProto = usmAESPrivProtocol;
+	    session->securityPrivProtoLen = USM_PRIV_PROTO_AES_LEN;
+	    *priv = g_strdup(cred[2]);
+	}
+    }
+    g_strfreev(cred);
+}
 
-    netsnmp_init_mib();
+static void
+free_security(struct snmp_session *session, gchar *auth, gchar *priv)
+{
+    g_free(session->community);
+    g_free(session->securityName);
+    g_free(auth);
+    g_free(priv);
 }
 
 gchar *
-simpleSNMPprobe(gchar *peer, gint port, gint vers, gchar *community)
+simpleSNMPprobe(gchar *peer, gint port, gint vers, gchar *community,
+		gint transport)
 {
     oid sysDescr[MAX_OID_LEN];
     size_t sysDescr_length;
@@ -135,7 +288,8 @@ simpleSNMPprobe(gchar *peer, gint port, gint vers, gchar *community)
     oid sysLocation[MAX_OID_LEN];
     size_t sysLocation_length;
 
-    struct snmp_session session, *ss;
+    struct snmp_session session;
+    void *sessp;
     struct snmp_pdu *pdu, *response;
     struct variable_list *vars;
 
@@ -145,6 +299,8 @@ simpleSNMPprobe(gchar *peer, gint port, gint vers, gchar *community)
     char textbuf[1024]; 
     char *result = NULL;
     char *tmp = NULL;
+    char *peername;
+    char *auth, *priv;
 
     /* transform interesting OIDs */
     sysDescr_length = MAX_OID_LEN;
@@ -174,21 +330,24 @@ simpleSNMPprobe(gchar *peer, gint port, gint vers, gchar *community)
     /* initialize session to default values */
     snmp_sess_init( &session );
 
-    session.version = vers == 2 ? SNMP_VERSION_2c : SNMP_VERSION_1;
-    session.community = (guchar *)community;
-    session.community_len = strlen(community);
-    session.peername = peer;
-
-#ifdef STREAM
-    session.flags |= SNMP_FLAGS_STREAM_SOCKET;
-    fprintf (stderr, "local port set to: %d\n", session.local_port);
-#endif /* STREAM */
+    session_security(&session, vers, community, &auth, &priv);
+    peername = transport_peername(peer, transport);
+    session.peername = peername;
 
     /* 
-     * Open an SNMP session.
+     * Open an SNMP session, the worker thread is using the library
+     * concurrently, so stick to the single session API.
      */
-    ss = snmp_open(&session);
-    if (ss == NULL){
+    g_rec_mutex_lock(&usm_lock);
+    tmp = usm_keys(&session, NULL, auth, priv);
+    sessp = tmp ? NULL : snmp_sess_open(&session);
+    g_rec_mutex_unlock(&usm_lock);
+    if (tmp) {
+      free_security(&session, auth, priv);
+      g_free(peername);
+      return tmp;
+    }
+    if (sessp == NULL){
       fprintf (stderr, "local port set to: %d\n", session.local_port);
       snmp_sess_perror("snmp_open", &session);
       exit(1);
@@ -213,7 +372,7 @@ simpleSNMPprobe(gchar *peer, gint port, gint vers, gchar *community)
      * "fix" the PDU (removing the error-prone OID) and retry.
      */
 retry:
-    status = snmp_synch_response(ss, pdu, &response);
+    status = snmp_sess_synch_response(sessp, pdu, &response);
     if (status == STAT_SUCCESS){
       if (response->errstat == SNMP_ERR_NOERROR){
         /* just render all vars */
@@ -254,287 +413,2253 @@ retry:
       }  /* endif -- SNMP_ERR_NOERROR */
 
     } else if (status == STAT_TIMEOUT){
-        snmp_close(ss);
-        return g_strdup_printf("Timeout: No Response from %s.\n", session.peername);
+        snmp_sess_close(sessp);
+        result = g_strdup_printf("Timeout: No Response from %s.\n", session.peername);
+        free_security(&session, auth, priv);
+        g_free(peername);
+        return result;
 
     } else {    /* status == STAT_ERROR */
       fprintf (stderr, "local port set to: %d\n", session.local_port);
-      snmp_sess_perror("STAT_ERROR", ss);
-      snmp_close(ss);
+      snmp_sess_perror("STAT_ERROR", snmp_sess_session(sessp));
+      snmp_sess_close(sessp);
+      free_security(&session, auth, priv);
+      g_free(peername);
       return NULL;
 
     }  /* endif -- STAT_SUCCESS */
 
     if (response)
       snmp_free_pdu(response);
-    snmp_close(ss);
+    snmp_sess_close(sessp);
+    free_security(&session, auth, priv);
+    g_free(peername);
 
     return result;
 }
 
-static int
-snmp_input(int op,
-	   struct snmp_session *session,
-	   int reqid,
-	   struct snmp_pdu *pdu,
-	   void *magic)
-{
-    struct variable_list *vars;
-    gint asn1_type[MAX_OID_STR];
-    gchar *result[MAX_OID_STR];
-    glong result_n[MAX_OID_STR];
-    gchar *error = NULL;
-    input_data *new_data = NULL;
-    gint num_pdu = 0;
-    gint i = 0;
+/*
+ * The SNMP worker threads.
+ *
+ * Agents are sharded over a pool of worker threads.  Each shard owns
+ * its sessions and its poll scheduler, and opens, reads and times out
+ * its sessions using the thread-safe snmp_sess_* single-session API.
+ * The GTK thread hands commands to a shard through an async queue (and
+ * a wakeup pipe to break the shard's select()), the shard hands decoded
+ * results back through a lock-free single-producer/single-consumer ring.
+ * simpleSNMPupdate() merges the rings of all shards for the consumer.
+ */
 
-    if (op == RECEIVED_MESSAGE) {
+enum {
+    CMD_OPEN,
+    CMD_POLL,
+    CMD_INTERVAL,
+    CMD_CLOSE
+};
+
+typedef struct snmp_command snmp_command;
+
+struct snmp_command {
+	gint			cmd;
+	simple_session		*ss;
+	gint			num_oid;
+	oid			*name[MAX_OID_STR];
+	size_t			name_length[MAX_OID_STR];
+	gint			refresh[MAX_OID_STR];
+	gint64			interval;
+};
+
+/* A decoded response, published by a shard to the GTK thread */
+
+typedef struct snmp_result snmp_result;
+
+struct snmp_result {
+	simple_session		*ss;
+	/* becomes the back set of the reader's input_data as it is */
+	sample_set		set;
+	gchar			*error;
+	/* release is set once the shard is done with ss */
+	gint			release;
+};
+
+/* Must be a power of two */
+#define RESULT_RING_SIZE	1024
+
+typedef struct result_ring result_ring;
+
+struct result_ring {
+	volatile gint		head;	/* written by the shard only */
+	volatile gint		tail;	/* written by the GTK thread only */
+	snmp_result		slot[RESULT_RING_SIZE];
+};
+
+typedef struct snmp_shard snmp_shard;
+
+struct snmp_shard {
+	GThread			*thread;
+	GAsyncQueue		*commands;
+	gint			wakeup[2];
+	result_ring		results;
+	/* the following are only touched by the shard's thread */
+	GSList			*sessions;
+	GSList			*releasing;
+	GHashTable		*agents;	/* by "peer:port" */
+	simple_session		**heap;		/* polls, ordered by due */
+	gint			heap_len;
+	gint			heap_size;
+	gulong			dropped;
+};
+
+/* IF-MIB interface counters and their ifCounterDiscontinuityTime */
+static oid ifEntry[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1 };
+static oid ifXEntry[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1 };
+#define IF_COUNTER_DISCONTINUITY_TIME	19
+#define DISC_OID_LEN	(OID_LENGTH(ifXEntry) + 2)
 
-        if (pdu->errstat == SNMP_ERR_NOERROR) {
+/*
+ * What the sessions to one agent have in common.  All of them are in the
+ * same shard, which fetches sysUpTime for them once per poll interval.
+ */
+typedef struct snmp_agent snmp_agent;
+
+struct snmp_agent {
+	gchar			*key;
+	gint			refs;
+	gint64			uptime;		/* TimeTicks, -1 if unknown */
+	gint64			uptime_time;	/* monotonic usec it was valid */
+	gint64			uptime_sent;	/* when it was last asked for */
+	gint			boots;		/* restarts seen */
+	/* the varbinds per request it handles, 0 if unlimited */
+	gint			max_var;
+	gint			max_var_ok;	/* requests of that size since */
+	/* the connection shared by the sessions over TCP */
+	void			*tcp_sessp;
+	gboolean		tcp_lost;	/* closed by the agent */
+	gint64			tcp_retry;	/* monotonic usec to reconnect */
+	gint64			tcp_backoff;	/* usec, 0 once it answers */
+	GSList			*orphans;	/* requests of closed sessions */
+	/* a token bucket on the PDUs sent, one token per PDU */
+	gdouble			rate;		/* PDUs/s, 0 if unlimited */
+	gdouble			tokens;
+	gint64			tokens_time;	/* monotonic usec they were valid */
+	gint			rate_serial;	/* of the limit rate was set from */
+	/* the OIDs polled, snmp_sub by credentials and dotted name */
+	GHashTable		*subs;
+};
+
+/* Try one more varbind per request after that many went fine */
+#define MAX_VAR_PROBE		100
+
+/* Until a TCP connection is tried again, doubled with every failure */
+#define TCP_BACKOFF_FIRST	(1 * G_USEC_PER_SEC)
+#define TCP_BACKOFF_MAX		(64 * G_USEC_PER_SEC)
+
+/* The tokens an agent saves up, at least one PDU or a second's worth */
+#define RATE_BURST(rate)	MAX((rate), 1.0)
+
+/* Polls until a failing OID is rechecked, doubled with every failure */
+#define QUARANTINE_FIRST	8
+#define QUARANTINE_MAX		512
+
+/* What a varbind of a request is for: an OID, else one of these */
+#define VAR_DISC		0x100	/* + index of the discontinuity OID */
+#define VAR_UPTIME		0x200
+#define MAX_REQUEST_VAR		(2 * MAX_OID_STR + 1)
+
+/* A poll, split into one or more requests */
+typedef struct snmp_round snmp_round;
+
+struct snmp_round {
+	snmp_result		result;		/* collected so far */
+	gint			pending;	/* requests in flight */
+};
+
+typedef struct snmp_request snmp_request;
+
+struct snmp_request {
+	simple_session		*ss;		/* NULL once it's closed */
+	snmp_agent		*agent;
+	snmp_round		*round;
+	gint			reqid;
+	gint64			sent;		/* monotonic usec */
+	gint			num_var;
+	gint			var[MAX_REQUEST_VAR];
+	/* of the OIDs among var, NULL for the others */
+	struct snmp_sub		*sub[MAX_REQUEST_VAR];
+};
 
-	    /*
-		fprintf(stderr, "recv from (@ %ld): %s type: %d\n",
-	            	pdu->time, session->peername, pdu->variables->type);
-	    */
+/*
+ * An OID of an agent and the sessions polling it.  Whichever of them is
+ * due first fetches it, the others take the value from here or wait for
+ * the request on its way, so the agent is asked once per the shortest
+ * interval among them.  Only sessions with the same version and
+ * credentials share, the agent may show each of them a different view.
+ */
+typedef struct snmp_sub snmp_sub;
+
+struct snmp_sub {
+	gchar			*key;
+	gint			refs;		/* sessions polling it */
+	/* the latest value, taken at time (local monotonic usec) */
+	gint64			time;		/* 0 if none yet */
+	gint			asn1_type;
+	gchar			*sample;
+	gint64			sample_n;
+	gint			kind;
+	guint			resets;		/* counter resets seen */
+	/* the requests in flight with it, and the last session to send one */
+	gint			fetching;
+	simple_session		*fetcher;
+	GSList			*waiters;	/* snmp_waiter */
+};
+
+/* A round of another session, waiting for a value being fetched */
+typedef struct {
+	simple_session		*ss;
+	snmp_round		*round;
+	gint			k;		/* the OID of ss */
+} snmp_waiter;
+
+/* sysUpTime.0 */
+static oid sysUpTime[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+
+struct simple_session {
+	guint			id;		/* in captures */
+	snmp_shard		*shard;
+	gchar			*placed;	/* "peer:port", GTK thread */
+	snmp_agent		*agent;
+	gint			boots;		/* of the agent, last seen */
+	gint			transport;
+	/* owned by the shard, the agent's connection over TCP */
+	void			*sessp;
+	struct snmp_session	template;
+	gchar			*auth_pass;	/* v3, NULL if none */
+	gchar			*priv_pass;
+	gint			num_oid;
+	oid			*name[MAX_OID_STR];
+	size_t			name_length[MAX_OID_STR];
+	snmp_sub		*sub[MAX_OID_STR];
+	gint64			seen[MAX_OID_STR];	/* time of the value */
+	guint			resets[MAX_OID_STR];	/* of the sub, seen */
+	gint			refresh[MAX_OID_STR];	/* in polls */
+	gint			wait[MAX_OID_STR];	/* polls until due */
+	/* OIDs the agent failed on, rechecked on their own */
+	guint			quarantine;	/* mask of OIDs */
+	gint			backoff[MAX_OID_STR];	/* in polls */
+	/* the latest value of each OID, handed out while it isn't due */
+	guint			cached;		/* mask of OIDs */
+	gint			cache_type[MAX_OID_STR];
+	gchar			*cache_sample[MAX_OID_STR];
+	gint64			cache_n[MAX_OID_STR];
+	gint			cache_kind[MAX_OID_STR];
+	gint64			interval;	/* usec, 0 for a single request */
+	gint64			due;		/* monotonic usec */
+	gint			heap_index;	/* -1 if not scheduled */
+	guint			deferred;	/* polls held back by the rate */
+	gboolean		held;		/* the poll due is one of them */
+	gboolean		paused;		/* until the interval is set */
+	gboolean		rebase;		/* deltas start over after a pause */
+	/* the polls in flight, in the order they were sent */
+	GSList			*rounds;
+	gint			num_rounds;
+	GSList			*requests;	/* of all rounds */
+	/* ifCounterDiscontinuityTime for the interfaces polled */
+	gint			num_disc;
+	oid			disc_name[MAX_OID_STR][DISC_OID_LEN];
+	guint			disc_for[MAX_OID_STR];	/* mask of OIDs */
+	glong			disc_value[MAX_OID_STR]; /* -1 if unknown */
+	gint64			disc_time[MAX_OID_STR];	/* when it was valid */
+	guint			disc_missing;	/* mask of unsupported */
+	/* owned by the GTK thread, NULL once the session is closed */
+	input_data		*data;
+};
+
+#define MAX_SHARDS		64
+
+static snmp_shard *shards[MAX_SHARDS];
+static gint num_shards;		/* shards running */
+static gint use_shards;		/* shards new sessions are spread over */
+/* the shard of each agent with open sessions, by "peer:port" */
+static GHashTable *placements;
+static gint pipeline = 1;	/* polls in flight per session */
+static guint num_opened;	/* sessions, for their ids */
+static Capture *capture;	/* NULL unless recording */
+/* monotonic usec, a simulation brings its own clock and steps the shards */
+static gint64 (*clock_now)(void) = g_get_monotonic_time;
+static gboolean stepped;
+/* PDUs/s per agent by "peer:port", "" for any other agent */
+static GHashTable *rate_limits;
+static GMutex rate_lock;
+static volatile gint rate_serial;	/* bumped with every change */
+
+
+static gboolean
+ring_push(result_ring *ring, snmp_result *result)
+{
+    guint head = g_atomic_int_get(&ring->head);
+    guint tail = g_atomic_int_get(&ring->tail);
+
+    if (head - tail >= RESULT_RING_SIZE)
+	return FALSE;
+    ring->slot[head & (RESULT_RING_SIZE - 1)] = *result;
+    /* publish the slot only after it has been filled */
+    g_atomic_int_set(&ring->head, head + 1);
+    return TRUE;
+}
 
-            for(vars = pdu->variables; vars; vars = vars->next_variable) {
-		/*
-		    fprintf(stderr, "recv[%d] type: %d\n", i, vars->type);
-		*/
-                switch (vars->type) {
-		case ASN_TIMETICKS:
-		    asn1_type[i] = ASN_TIMETICKS;
-		    result_n[i] = *vars->val.integer;
-		    result[i] = strdup_uptime (result_n[i]);
-		    break;
-		case ASN_OCTET_STR: /* value is a string */
-		    asn1_type[i] = ASN_OCTET_STR;
-		    result[i] = g_strndup((gchar *)vars->val.string, 
-								vars->val_len);
-		    /* Add as ASN_INTEGER if it converts properly */
-		    if (sscanf (result[i], "%lu", &result_n[i]) == 1) {
-			asn1_type[i] = ASN_INTEGER;
-		    } else {
-			result_n[i] = 0;
-		    }
-		    /*
-			fprintf(stderr, "recv  result_n: %lu\n", result_n);
-		    */
-		    break;
-		case ASN_INTEGER: /* value is a integer */
-		case ASN_COUNTER: /* use as if it were integer */
-		case ASN_UNSIGNED: /* use as if it were integer */
-		    asn1_type[i] = ASN_INTEGER;
-		    result_n[i] = *vars->val.integer;
-		    result[i] = g_strdup_printf("%ld", *vars->val.integer);
-		    break;
-		case ASN_COUNTER64:
-		    asn1_type[i] = ASN_INTEGER;
-		    result_n[i] = vars->val.counter64->low; // TODO: this ignores upper 32 "high" bits
-#ifdef G_GUINT64_FORMAT
-            result[i] = g_strdup_printf("%" G_GUINT64_FORMAT, ((guint64)vars->val.counter64->high << 32) | vars->val.counter64->low);
-#else
-		    result[i] = g_strdup_printf("%lu", vars->val.counter64->low);
-#endif
-		    break;
-		default:
-		    i--;
-		    fprintf(stderr, "recv unknown ASN type: %d - "
-				"please report to zany@triq.net\n", vars->type);
-		}
-		i++;
-	    }
-	    num_pdu = i;
-        } else {
-            error = g_strdup_printf("Error in packet, Reason: %s",
-				     snmp_errstring(pdu->errstat));
+static gboolean
+ring_pop(result_ring *ring, snmp_result *result)
+{
+    guint tail = g_atomic_int_get(&ring->tail);
+    guint head = g_atomic_int_get(&ring->head);
+
+    if (head == tail)
+	return FALSE;
+    *result = ring->slot[tail & (RESULT_RING_SIZE - 1)];
+    /* hand the slot back only after it has been copied */
+    g_atomic_int_set(&ring->tail, tail + 1);
+    return TRUE;
+}
 
-	    if (pdu->errstat == SNMP_ERR_NOSUCHNAME) {
-		error = g_strdup_printf("Error! This name doesn't exist!");
-            }
-        }
+static void
+free_set(sample_set *set)
+{
+    gint i;
 
+    for (i = 0; i < set->num_sample; i++) {
+	g_free(set->sample[i]);
+	set->sample[i] = NULL;
+    }
+    set->num_sample = 0;
+}
 
-    } else if (op == TIMED_OUT){
-        error = g_strdup_printf("Error! SNMP Timeout.");
+static void
+free_result(snmp_result *result)
+{
+    free_set(&result->set);
+    g_free(result->error);
+}
+
+static void
+publish_result(snmp_shard *shard, snmp_result *result)
+{
+    if (!ring_push(&shard->results, result)) {
+	/* the GTK thread is behind, this sample is lost */
+	free_result(result);
+	shard->dropped++;
     }
-    /* we use session's callback magic to pass back data */
-    if (session->callback_magic) {
-	new_data = session->callback_magic;
-	if (error) {
-	    if (new_data->error) g_free(new_data->error);
-	    new_data->error = error;
-	} else {
-	    for (i = 0; i < num_pdu; i++) {
-		if (new_data->sample[i])
-		    g_free(new_data->sample[i]);
-		new_data->asn1_type[i] = asn1_type[i];
-		new_data->sample[i] = result[i];
-		new_data->sample_n[i] = result_n[i];
-		/*
-		    print_objid (name, name_length);
-		    print_objid (sysUpTime, sysUpTime_length);
-		*/
-	    }
-	}
-	/* Mark that there is new data */
-	new_data->num_sample = num_pdu;
-	new_data->new = 1;
+}
+
+static void
+publish_error(simple_session *ss, gchar *error)
+{
+    snmp_result result;
+
+    memset(&result, 0, sizeof(result));
+    result.ss = ss;
+    result.error = error;
+    publish_result(ss->shard, &result);
+}
+
+static snmp_agent *
+agent_get(snmp_shard *shard, simple_session *ss)
+{
+    snmp_agent *agent;
+    gchar *key;
+
+    key = g_strdup_printf("%s:%d", agent_peername(ss->template.peername),
+						ss->template.remote_port);
+    agent = g_hash_table_lookup(shard->agents, key);
+    if (agent) {
+	g_free(key);
+    } else {
+	agent = g_new0(snmp_agent, 1);
+	agent->key = key;
+	agent->uptime = -1;
+	agent->rate_serial = -1;
+	g_hash_table_insert(shard->agents, agent->key, agent);
     }
-    return 1;
+    agent->refs++;
+    return agent;
 }
 
-void
-simpleSNMPupdate()
+static void request_done(snmp_request *request, guint got);
+
+static void
+agent_put(snmp_shard *shard, snmp_agent *agent)
 {
-    int count;
-    int numfds, block;
-    fd_set fdset;
-    struct timeval timeout, *tvp;
-
-    numfds = 0;
-    FD_ZERO(&fdset);
-    block = 0;
-    tvp = &timeout;
-    timerclear(tvp);
-    tvp->tv_sec = 0;
-    snmp_select_info(&numfds, &fdset, tvp, &block);
-	/*        if (block == 1)
-		  tvp = NULL; */ /* block without timeout */
-    count = select(numfds, &fdset, 0, 0, tvp);
-    if (count > 0){
-        snmp_read(&fdset);
-    } else switch(count){
-        case 0:
-            snmp_timeout();
-	    break;
-        case -1:
-	    fprintf(stderr, "snmp error on select\n");
-	    break;
-        default:
-            fprintf(stderr, "select returned %d\n", count);
+    GSList *list;
+
+    if (--agent->refs > 0)
+	return;
+    /* closing may time out the orphans still in flight */
+    if (agent->tcp_sessp)
+	snmp_sess_close(agent->tcp_sessp);
+    for (list = agent->orphans; list; list = list->next)
+	request_done(list->data, 0);
+    g_slist_free_full(agent->orphans, g_free);
+    /* by now the sessions have let go of all of them */
+    if (agent->subs)
+	g_hash_table_destroy(agent->subs);
+    g_hash_table_remove(shard->agents, agent->key);
+    g_free(agent->key);
+    g_free(agent);
+}
+
+static snmp_sub *
+sub_get(simple_session *ss, gint k)
+{
+    snmp_agent *agent = ss->agent;
+    snmp_sub *sub;
+    GString *key;
+    gint i;
+
+    /* for v3 the community holds the user and the passphrases */
+    key = g_string_new("");
+    g_string_printf(key, "%ld %s %s ", ss->template.version,
+		    ss->template.community ? (gchar *)ss->template.community
+					   : "",
+		    ss->template.securityName ? ss->template.securityName : "");
+    for (i = 0; i < ss->name_length[k]; i++)
+	g_string_append_printf(key, ".%lu", (gulong)ss->name[k][i]);
+    if (!agent->subs)
+	agent->subs = g_hash_table_new(g_str_hash, g_str_equal);
+    sub = g_hash_table_lookup(agent->subs, key->str);
+    if (sub) {
+	g_string_free(key, TRUE);
+    } else {
+	sub = g_new0(snmp_sub, 1);
+	sub->key = g_string_free(key, FALSE);
+	g_hash_table_insert(agent->subs, sub->key, sub);
     }
+    sub->refs++;
+    return sub;
 }
 
-struct snmp_session *
-simpleSNMPopen(gchar *peername,
-	       gint port,
-	       gint vers,
-	       gchar *community,
-	       void *data)
+/* Free an OID nobody polls or waits for any more */
+static void
+sub_put(snmp_agent *agent, snmp_sub *sub)
 {
-    struct snmp_session session, *ss;
+    if (sub->refs > 0 || sub->fetching > 0 || sub->waiters)
+	return;
+    g_hash_table_remove(agent->subs, sub->key);
+    g_free(sub->key);
+    g_free(sub->sample);
+    g_free(sub);
+}
 
-    /*
-     * initialize session to default values
-     */
-    snmp_sess_init( &session );
+static void
+agent_uptime(snmp_agent *agent, struct variable_list *vars, gint64 timestamp)
+{
+    gint64 uptime;
+
+    /* with pipelining an older response may come in late */
+    if (vars->type != ASN_TIMETICKS || timestamp < agent->uptime_time)
+	return;
+    uptime = (guint32)*vars->val.integer;
+    /* going backwards, other than wrapping at 2^32, is a restart */
+    if (agent->uptime > uptime && agent->uptime - uptime < G_MAXINT32)
+	agent->boots++;
+    agent->uptime = uptime;
+    agent->uptime_time = timestamp;
+}
 
-    session.version = vers == 2 ? SNMP_VERSION_2c : SNMP_VERSION_1;
-    session.community = (guchar *)community;
-    session.community_len = strlen(community);
-    session.peername = peername;
-    session.remote_port = port;
+/*
+ * Refill the agent's token bucket for the time gone by.  A changed limit
+ * is picked up here, with a full bucket.
+ */
+static void
+agent_refill(snmp_agent *agent, gint64 now)
+{
+    gdouble *rate;
+    gint serial = g_atomic_int_get(&rate_serial);
+
+    if (agent->rate_serial != serial) {
+	g_mutex_lock(&rate_lock);
+	rate = rate_limits ? g_hash_table_lookup(rate_limits, agent->key) : NULL;
+	if (!rate && rate_limits)
+	    rate = g_hash_table_lookup(rate_limits, "");
+	agent->rate = rate ? *rate : 0;
+	g_mutex_unlock(&rate_lock);
+	agent->tokens = RATE_BURST(agent->rate);
+	agent->tokens_time = now;
+	agent->rate_serial = serial;
+    }
+    if (agent->rate <= 0 || now <= agent->tokens_time)
+	return;
+    agent->tokens = MIN(agent->tokens + agent->rate
+			* (now - agent->tokens_time) / G_USEC_PER_SEC,
+			RATE_BURST(agent->rate));
+    agent->tokens_time = now;
+}
 
-    session.retries = SNMP_DEFAULT_RETRIES;
-    session.timeout = SNMP_DEFAULT_TIMEOUT;
+/* The agent's sysUpTime, extrapolated to the local timestamp */
+static gint64
+agent_uptime_at(snmp_agent *agent, gint64 timestamp)
+{
+    if (agent->uptime < 0)
+	return -1;
+    /* TimeTicks are 1/100 s */
+    return agent->uptime + (timestamp - agent->uptime_time) / 10000;
+}
 
-    session.callback = snmp_input;
-    session.callback_magic = data; /* most likely a Reader */
-    session.authenticator = NULL;
+/* Fetch the given OIDs with the next request, cached or not */
+static void
+invalidate(simple_session *ss, guint mask)
+{
+    gint i;
 
-#ifdef STREAM
-    session.flags |= SNMP_FLAGS_STREAM_SOCKET;
-#endif
+    /* failed OIDs keep their backoff */
+    mask &= ~ss->quarantine;
+    for (i = 0; i < ss->num_oid; i++)
+	if (mask & (1 << i))
+	    ss->wait[i] = 0;
+}
 
-    /* 
-     * Open an SNMP session.
-     */
-    ss = snmp_open(&session);
-    if (ss == NULL){
-	input_data *new_data = data;
-	gint sys_errno;
-	gint snmp_errno;
-	gchar *error_msg = NULL;
-	snmp_error (&session, &sys_errno, &snmp_errno, &error_msg);
-	if (new_data->error) g_free (new_data->error);
-	new_data->error = error_msg;
-	new_data->new = 1;
-    }
+/* Polls until an OID just fetched is due again */
+static gint
+refresh_wait(simple_session *ss, gint k)
+{
+    return ss->refresh[k] == REFRESH_STATIC ? G_MAXINT : ss->refresh[k] - 1;
+}
 
-    return ss;
+/* A poll went out, count down to the next fetch of each OID */
+static void
+count_down(simple_session *ss)
+{
+    gint i;
+
+    for (i = 0; i < ss->num_oid; i++) {
+	if (ss->wait[i]-- > 0)
+	    continue;
+	if (ss->quarantine & (1 << i))
+	    ss->wait[i] = ss->backoff[i];
+	else
+	    ss->wait[i] = refresh_wait(ss, i);
+    }
 }
 
-gint
-simpleSNMPsend(struct snmp_session *session, gchar **oid_str, gint num_oid_str)
+static void
+check_discontinuity(simple_session *ss, gint k,
+		    struct variable_list *vars, snmp_result *result)
 {
-    struct snmp_pdu *pdu;
-    oid name[num_oid_str][MAX_OID_LEN];
-    size_t name_length[num_oid_str];
-    gchar *error = NULL;
-    input_data *new_data = NULL;
     gint i;
 
-    /* Prepare the objid's */
-    for (i = 0; i < num_oid_str; i++) {
-	name_length[i] = MAX_OID_LEN;
-	if (!snmp_parse_oid(oid_str[i], name[i], &name_length[i])) {
-	    error = g_strdup_printf("error parsing oid: %s", oid_str[i]);
-	    break;
+    if (vars->type != ASN_TIMETICKS) {
+	/* noSuchObject or noSuchInstance, don't ask again */
+	ss->disc_missing |= 1 << k;
+	return;
+    }
+    /* with pipelining an older response may come in late */
+    if (result->set.timestamp < ss->disc_time[k])
+	return;
+    if (ss->disc_value[k] >= 0 && ss->disc_value[k] != *vars->val.integer) {
+	result->set.discontinuity |= ss->disc_for[k];
+	invalidate(ss, ss->disc_for[k]);
+	/* the sessions sharing the counters learn of it from their subs */
+	for (i = 0; i < ss->num_oid; i++) {
+	    if (!(ss->disc_for[k] & (1 << i)) || !ss->sub[i])
+		continue;
+	    ss->sub[i]->resets++;
+	    ss->resets[i] = ss->sub[i]->resets;
 	}
     }
+    ss->disc_value[k] = *vars->val.integer;
+    ss->disc_time[k] = result->set.timestamp;
+}
 
-    if (session->callback_magic) {
-	new_data = session->callback_magic;
-	if (error) {
-	    if (new_data->error) g_free (new_data->error);
-	    new_data->error = error;
-	    new_data->new = 1;
+static gboolean
+decode_value(struct variable_list *vars, gint *asn1_type, gchar **sample,
+	     gint64 *sample_n, gint *kind)
+{
+    *kind = SAMPLE_GAUGE;
+    switch (vars->type) {
+    case ASN_TIMETICKS:
+	*asn1_type = ASN_TIMETICKS;
+	*kind = SAMPLE_TIMETICKS;
+	*sample_n = (guint32)*vars->val.integer;
+	*sample = strdup_uptime (*sample_n);
+	break;
+    case ASN_OCTET_STR: /* value is a string */
+	*asn1_type = ASN_OCTET_STR;
+	*sample = g_strndup((gchar *)vars->val.string, vars->val_len);
+	/* Add as ASN_INTEGER if it converts properly */
+	if (sscanf (*sample, "%" G_GINT64_FORMAT, sample_n) == 1) {
+	    *asn1_type = ASN_INTEGER;
+	} else {
+	    *sample_n = 0;
 	}
+	break;
+    case ASN_INTEGER: /* value is a integer */
+	*asn1_type = ASN_INTEGER;
+	*sample_n = *vars->val.integer;
+	*sample = g_strdup_printf("%" G_GINT64_FORMAT, *sample_n);
+	break;
+    case ASN_COUNTER: /* use as if it were integer */
+	*kind = SAMPLE_COUNTER32;
+	/* FALLTHROUGH */
+    case ASN_UNSIGNED: /* use as if it were integer */
+	*asn1_type = ASN_INTEGER;
+	*sample_n = (guint32)*vars->val.integer;
+	*sample = g_strdup_printf("%" G_GINT64_FORMAT, *sample_n);
+	break;
+    case ASN_COUNTER64:
+	/* the full 64 bits */
+	*asn1_type = ASN_INTEGER;
+	*kind = SAMPLE_COUNTER64;
+	*sample_n = ((guint64)vars->val.counter64->high << 32)
+				| (guint32)vars->val.counter64->low;
+	*sample = g_strdup_printf("%" G_GUINT64_FORMAT, (guint64)*sample_n);
+	break;
+    default:
+	fprintf(stderr, "recv unknown ASN type: %d - "
+			"please report to zany@triq.net\n", vars->type);
+	return FALSE;
     }
-    if (!error) {
-	/* 
-	 * Create PDU for GET request and add object names to request.
-	 */
-	pdu = snmp_pdu_create(SNMP_MSG_GET);
-
-	/* 
-	 * First insert uptime request into PDU, then the actual object's
-	 */
-
-	/*
-	    fprintf (stderr, "Preparing send for %d vars\n", num_oid_str);
-	*/
-	for (i = 0; i < num_oid_str; i++) {
-	    snmp_add_null_var(pdu, name[i], name_length[i]);
-	    /*
-		print_objid (name[i], name_length[i]);
-	    */
-	}
+    return TRUE;
+}
+
+/* Take a value fetched by a round into the cache, FALSE if it went backwards */
+static gboolean
+cache_value(simple_session *ss, gint k, snmp_result *result)
+{
+    gboolean forward = TRUE;
+
+    /* TimeTicks going backwards, the agent was restarted */
+    if (result->set.kind[k] == SAMPLE_TIMETICKS && (ss->cached & (1 << k))
+	    && result->set.sample_n[k] < ss->cache_n[k])
+	forward = FALSE;
+    g_free(ss->cache_sample[k]);
+    ss->cache_type[k] = result->set.asn1_type[k];
+    ss->cache_sample[k] = g_strdup(result->set.sample[k]);
+    ss->cache_n[k] = result->set.sample_n[k];
+    ss->cache_kind[k] = result->set.kind[k];
+    ss->cached |= 1 << k;
+    return forward;
+}
+
+static void
+free_cache(simple_session *ss)
+{
+    gint i;
+
+    for (i = 0; i < MAX_OID_STR; i++) {
+	g_free(ss->cache_sample[i]);
+	ss->cache_sample[i] = NULL;
+    }
+    ss->cached = 0;
+}
+
+static void
+free_round(snmp_round *round)
+{
+    gint i;
 
-	/* 
-	 * Perform the request.
-	 */
-
-	if (!snmp_send(session, pdu)) {
-	    error = g_strdup_printf("snmp_send() returned error\n");
-	    if (session->callback_magic) {
-		new_data = session->callback_magic;
-		if (new_data->error) g_free (new_data->error);
-		new_data->error = error;
-		new_data->new = 1;
+    /* until it is finished, only the fetched samples are set */
+    for (i = 0; i < MAX_OID_STR; i++)
+	g_free(round->result.set.sample[i]);
+    g_free(round->result.error);
+    g_free(round);
+}
+
+static gboolean send_request(simple_session *ss, snmp_round *round,
+			     gint *var, gint num_var);
+
+/* Complete a round with the cached values and publish it */
+static void
+finish_round(simple_session *ss, snmp_round *round)
+{
+    snmp_result *result = &round->result;
+    gint i;
+
+    if (result->error) {
+	/* the agent may have been restarted meanwhile */
+	invalidate(ss, ~0);
+	for (i = 0; i < MAX_OID_STR; i++) {
+	    g_free(result->set.sample[i]);
+	    result->set.sample[i] = NULL;
+	}
+	result->set.fresh = 0;
+	result->set.shared = 0;
+	result->set.discontinuity = 0;
+    } else {
+	/* OIDs not due are handed out from the cache */
+	result->set.missing = ss->quarantine;
+	for (i = 0; i < ss->num_oid; i++) {
+	    if (result->set.fresh & (1 << i)) {
+		if (!cache_value(ss, i, result))
+		    invalidate(ss, ~0);
+		/* the newest, some may have been fetched by other sessions */
+		result->set.timestamp = MAX(result->set.timestamp,
+					    result->set.sample_time[i]);
+	    } else if (ss->cached & (1 << i)) {
+		result->set.sample_time[i] = ss->seen[i];
+		result->set.asn1_type[i] = ss->cache_type[i];
+		result->set.sample[i] = g_strdup(ss->cache_sample[i]);
+		result->set.sample_n[i] = ss->cache_n[i];
+		result->set.kind[i] = ss->cache_kind[i];
+	    } else {
+		result->set.asn1_type[i] = ASN_OCTET_STR;
+		result->set.sample[i] = g_strdup("");
+		result->set.kind[i] = SAMPLE_GAUGE;
 	    }
 	}
+	result->set.num_sample = ss->num_oid;
+	if (!result->set.timestamp)
+	    result->set.timestamp = clock_now();
+
+	result->set.uptime = agent_uptime_at(ss->agent, result->set.timestamp);
+	if (ss->boots != ss->agent->boots) {
+	    /* seen by this or another session to the agent */
+	    ss->boots = ss->agent->boots;
+	    result->set.reboot = TRUE;
+	    invalidate(ss, ~0);
+	}
     }
 
-    return (!error);
+    /* the result now owns the samples */
+    publish_result(ss->shard, result);
+    g_free(round);
 }
 
-void 
-simpleSNMPclose(struct snmp_session *session)
+/*
+ * Publish the rounds answered in the order they were sent, so a late
+ * response can't make the samples of a reader go back in time.
+ */
+static void
+publish_rounds(simple_session *ss)
+{
+    snmp_round *round;
+
+    while (ss->rounds) {
+	round = ss->rounds->data;
+	if (round->pending > 0)
+	    break;
+	ss->rounds = g_slist_delete_link(ss->rounds, ss->rounds);
+	ss->num_rounds--;
+	finish_round(ss, round);
+    }
+}
+
+/* Hand a value another session fetched to a round, as if it fetched it */
+static void
+share_value(simple_session *ss, snmp_round *round, gint k, snmp_sub *sub)
+{
+    sample_set *set = &round->result.set;
+
+    g_free(set->sample[k]);
+    set->asn1_type[k] = sub->asn1_type;
+    set->sample[k] = g_strdup(sub->sample);
+    set->sample_n[k] = sub->sample_n;
+    set->kind[k] = sub->kind;
+    set->sample_time[k] = sub->time;
+    set->fresh |= 1 << k;
+    set->shared |= 1 << k;
+    if (ss->resets[k] != sub->resets) {
+	/* the session that fetched it saw the counter reset */
+	set->discontinuity |= 1 << k;
+	ss->resets[k] = sub->resets;
+    }
+    ss->seen[k] = sub->time;
+}
+
+/*
+ * A request with the OID is through.  The rounds waiting for it take the
+ * value it brought, or go without once no other request has it.
+ */
+static void
+sub_done(snmp_sub *sub, gboolean answered)
+{
+    snmp_waiter *waiter;
+    GSList *list, *waiters;
+
+    if (--sub->fetching > 0 && !answered)
+	return;
+    waiters = sub->waiters;
+    sub->waiters = NULL;
+    for (list = waiters; list; list = list->next) {
+	waiter = list->data;
+	if (answered)
+	    share_value(waiter->ss, waiter->round, waiter->k, sub);
+	waiter->round->pending--;
+	publish_rounds(waiter->ss);
+	g_free(waiter);
+    }
+    g_slist_free(waiters);
+}
+
+/* got has bit pos set if the value of var[pos] made it into its sub */
+static void
+request_done(snmp_request *request, guint got)
+{
+    gint pos;
+
+    for (pos = 0; pos < request->num_var; pos++) {
+	if (!request->sub[pos])
+	    continue;
+	sub_done(request->sub[pos], (got & (1 << pos)) != 0);
+	sub_put(request->agent, request->sub[pos]);
+    }
+}
+
+/* Stop polling an OID, with release its rounds stop waiting for it */
+static void
+sub_drop(simple_session *ss, gint k, gboolean release)
+{
+    snmp_sub *sub = ss->sub[k];
+    snmp_waiter *waiter;
+    GSList *list, *next;
+
+    if (!sub)
+	return;
+    for (list = sub->waiters; list; list = next) {
+	next = list->next;
+	waiter = list->data;
+	if (waiter->ss != ss)
+	    continue;
+	sub->waiters = g_slist_delete_link(sub->waiters, list);
+	if (release)
+	    waiter->round->pending--;
+	g_free(waiter);
+    }
+    ss->sub[k] = NULL;
+    sub->refs--;
+    sub_put(ss->agent, sub);
+}
+
+/*
+ * Leave out an OID the agent fails on, so the others still get through,
+ * and recheck it on its own with a growing backoff.
+ */
+static void
+quarantine(simple_session *ss, gint k)
+{
+    if (ss->quarantine & (1 << k))
+	ss->backoff[k] = MIN(2 * ss->backoff[k], QUARANTINE_MAX);
+    else
+	ss->backoff[k] = QUARANTINE_FIRST;
+    ss->quarantine |= 1 << k;
+    ss->wait[k] = ss->backoff[k];
+    ss->cached &= ~(1 << k);
+}
+
+/*
+ * Take the value of var[pos] of a request into its round, and into its
+ * sub for the other sessions.  Returns TRUE if the sub got it.
+ */
+static gboolean
+take_var(simple_session *ss, snmp_request *request, gint pos,
+	 struct variable_list *vars, gint64 sampled)
+{
+    snmp_result *result = &request->round->result;
+    snmp_sub *sub = request->sub[pos];
+    gint var = request->var[pos];
+
+    if (var == VAR_UPTIME) {
+	agent_uptime(ss->agent, vars, result->set.timestamp);
+    } else if (var >= VAR_DISC) {
+	check_discontinuity(ss, var - VAR_DISC, vars, result);
+    } else if (vars->type == SNMP_NOSUCHOBJECT
+	    || vars->type == SNMP_NOSUCHINSTANCE
+	    || vars->type == SNMP_ENDOFMIBVIEW) {
+	/* v2c reports a missing OID in an otherwise good response */
+	quarantine(ss, var);
+    } else if (decode_value(vars, &result->set.asn1_type[var],
+			    &result->set.sample[var], &result->set.sample_n[var],
+			    &result->set.kind[var])) {
+	result->set.fresh |= 1 << var;
+	result->set.sample_time[var] = sampled;
+	if (ss->quarantine & (1 << var)) {
+	    /* it's back */
+	    ss->quarantine &= ~(1 << var);
+	    ss->wait[var] = refresh_wait(ss, var);
+	}
+	ss->seen[var] = sampled;
+	/* with pipelining an older response may come in late */
+	if (sub && sampled > sub->time) {
+	    ss->resets[var] = sub->resets;
+	    g_free(sub->sample);
+	    sub->asn1_type = result->set.asn1_type[var];
+	    sub->sample = g_strdup(result->set.sample[var]);
+	    sub->sample_n = result->set.sample_n[var];
+	    sub->kind = result->set.kind[var];
+	    sub->time = sampled;
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+/*
+ * The agent failed on one varbind (v1 noSuchName and the like).  Like
+ * snmp_fix_pdu() does for the probe, ask again without it.
+ */
+static gboolean
+fix_request(simple_session *ss, snmp_request *request, gint index)
+{
+    gint var[MAX_REQUEST_VAR];
+    gint i, n = 0;
+
+    if (index < 1 || index > request->num_var)
+	return FALSE;
+    for (i = 0; i < request->num_var; i++) {
+	if (i == index - 1)
+	    continue;
+	var[n++] = request->var[i];
+    }
+
+    i = request->var[index - 1];
+    if (i == VAR_UPTIME)
+	return FALSE;
+    else if (i >= VAR_DISC)
+	ss->disc_missing |= 1 << (i - VAR_DISC);
+    else
+	quarantine(ss, i);
+
+    if (n > 0 && !send_request(ss, request->round, var, n)) {
+	if (!request->round->result.error)
+	    request->round->result.error =
+			g_strdup_printf("snmp_send() returned error\n");
+    }
+    return TRUE;
+}
+
+/*
+ * The agent can't answer that many varbinds in one message, remember
+ * its limit and ask again in two halves.
+ */
+static void
+split_request(simple_session *ss, snmp_request *request)
 {
+    snmp_agent *agent = ss->agent;
+    snmp_round *round = request->round;
+    gint half = request->num_var / 2;
+
+    if (agent->max_var == 0 || half < agent->max_var) {
+	agent->max_var = half;
+	agent->max_var_ok = 0;
+    }
+    if (!send_request(ss, round, request->var, half)
+	    || !send_request(ss, round, request->var + half,
+					request->num_var - half)) {
+	if (!round->result.error)
+	    round->result.error = g_strdup_printf("snmp_send() returned error\n");
+    }
+}
+
+static int
+snmp_input(int op,
+	   struct snmp_session *session,
+	   int reqid,
+	   struct snmp_pdu *pdu,
+	   void *magic)
+{
+    struct variable_list *vars;
+    snmp_request *request = magic;
+    simple_session *ss = request->ss;
+    snmp_agent *agent = request->agent;
+    snmp_result *result;
+    gint64 now = clock_now();
+    gint64 sampled;
+    guint got = 0;
+    gint pos;
+
+    capture_pdu(capture,
+		op == RECEIVED_MESSAGE ? CAPTURE_RESPONSE : CAPTURE_TIMEOUT,
+		ss ? ss->id : 0, reqid, now,
+		op == RECEIVED_MESSAGE ? pdu : NULL);
+
+    if (!ss) {
+	/* its session was closed, the connection stayed */
+	agent->orphans = g_slist_remove(agent->orphans, request);
+	request_done(request, 0);
+	g_free(request);
+	return 1;
+    }
+    ss->requests = g_slist_remove(ss->requests, request);
+    result = &request->round->result;
+
+    /* The agent sampled halfway through the first round trip */
+    if (!result->set.timestamp) {
+	result->set.rtt = now - request->sent;
+	result->set.timestamp = now - result->set.rtt / 2;
+    }
+    sampled = now - (now - request->sent) / 2;
+
+    if (op == RECEIVED_MESSAGE) {
+
+	/* the connection works, don't hold back a reconnect */
+	if (ss->transport == TRANSPORT_TCP)
+	    agent->tcp_backoff = 0;
+
+        if (pdu->errstat == SNMP_ERR_NOERROR) {
+
+	    /*
+		fprintf(stderr, "recv from (@ %ld): %s type: %d\n",
+	            	pdu->time, session->peername, pdu->variables->type);
+	    */
+
+            for(pos = 0, vars = pdu->variables; vars && pos < request->num_var;
+					pos++, vars = vars->next_variable) {
+		/*
+		    fprintf(stderr, "recv[%d] type: %d\n", pos, vars->type);
+		*/
+		if (take_var(ss, request, pos, vars, sampled))
+		    got |= 1 << pos;
+	    }
+
+	    /* slowly find out whether the agent takes more now */
+	    if (request->num_var == agent->max_var
+		    && ++agent->max_var_ok >= MAX_VAR_PROBE) {
+		agent->max_var++;
+		agent->max_var_ok = 0;
+	    }
+        } else if (pdu->errstat == SNMP_ERR_TOOBIG && request->num_var > 1) {
+	    split_request(ss, request);
+        } else if (pdu->errstat != SNMP_ERR_TOOBIG
+		    && fix_request(ss, request, pdu->errindex)) {
+	    /* the others are asked for again */
+        } else if (result->error) {
+	    /* one error per round is enough */
+        } else if (pdu->errstat == SNMP_ERR_NOSUCHNAME) {
+	    result->error = g_strdup_printf("Error! This name doesn't exist!");
+        } else {
+            result->error = g_strdup_printf("Error in packet, Reason: %s",
+				     snmp_errstring(pdu->errstat));
+        }
+
+
+    } else if (op == TIMED_OUT){
+	if (!result->error)
+	    result->error = g_strdup_printf("Error! SNMP Timeout.");
+    }
+
+    request->round->pending--;
+    request_done(request, got);
+    g_free(request);
+    publish_rounds(ss);
+    return 1;
+}
+
+/*
+ * The callback of the sessions themselves, the requests have their own.
+ * This is where net-snmp reports that the agent closed a TCP connection.
+ */
+static int
+agent_input(int op,
+	    struct snmp_session *session,
+	    int reqid,
+	    struct snmp_pdu *pdu,
+	    void *magic)
+{
+#ifdef NETSNMP_CALLBACK_OP_DISCONNECT
+    snmp_agent *agent = magic;
+
+    if (op == NETSNMP_CALLBACK_OP_DISCONNECT)
+	agent->tcp_lost = TRUE;
+#endif
+    return 1;
+}
+
+static void
+agent_backoff(snmp_agent *agent, gint64 now)
+{
+    if (agent->tcp_backoff)
+	agent->tcp_backoff = MIN(2 * agent->tcp_backoff, TCP_BACKOFF_MAX);
+    else
+	agent->tcp_backoff = TCP_BACKOFF_FIRST;
+    agent->tcp_retry = now + agent->tcp_backoff;
+}
+
+/*
+ * Open a session as set up in ss->template.  For v3 the keys are filled
+ * in, and the engine the library discovers is remembered for the agent.
+ */
+static void *
+open_session(simple_session *ss, struct snmp_session *session,
+	     gchar **error_msg)
+{
+    void *sessp;
+    gint sys_errno;
+    gint snmp_errno;
+
+    if (session->version != SNMP_VERSION_3) {
+	sessp = snmp_sess_open(session);
+    } else {
+	g_rec_mutex_lock(&usm_lock);
+	*error_msg = usm_keys(session, ss->agent->key,
+			      ss->auth_pass, ss->priv_pass);
+	sessp = *error_msg ? NULL : snmp_sess_open(session);
+	if (sessp)
+	    usm_learn(ss->agent->key, sessp);
+	g_rec_mutex_unlock(&usm_lock);
+	if (*error_msg)
+	    return NULL;
+    }
+    if (sessp == NULL)
+	snmp_error (session, &sys_errno, &snmp_errno, error_msg);
+    return sessp;
+}
+
+/*
+ * A v3 session joining the agent's TCP connection brings its user along,
+ * the connection only knows the one of the session that opened it.
+ */
+static void
+usm_join(simple_session *ss)
+{
+    struct snmp_session session;
+    gchar *error_msg;
+
+    if (ss->template.version != SNMP_VERSION_3)
+	return;
+    g_rec_mutex_lock(&usm_lock);
+    session = ss->template;
+    error_msg = usm_keys(&session, ss->agent->key,
+			 ss->auth_pass, ss->priv_pass);
+    if (!error_msg && session.securityEngineIDLen)
+	usm_create_user_from_session(&session);
+    g_rec_mutex_unlock(&usm_lock);
+    if (error_msg)
+	publish_error(ss, error_msg);
+}
+
+/*
+ * Sessions over TCP send on one connection per agent, opened by whichever
+ * of them polls first.  Their requests are pipelined on the stream and
+ * told apart by their own callbacks.  A connection that failed or was
+ * lost is tried again with a growing backoff.
+ */
+static void
+agent_connect(simple_session *ss)
+{
+    snmp_agent *agent = ss->agent;
+    struct snmp_session session;
+    gchar *error_msg = NULL;
+    gint64 now = clock_now();
+
+    if (agent->tcp_sessp == NULL && now >= agent->tcp_retry) {
+	session = ss->template;
+	session.callback_magic = agent;
+	agent->tcp_sessp = open_session(ss, &session, &error_msg);
+	if (agent->tcp_sessp == NULL) {
+	    agent_backoff(agent, now);
+	    publish_error(ss, error_msg);
+	    return;
+	}
+    }
+    if (agent->tcp_sessp == NULL) {
+	/* the same message each time, so the reader shows it once */
+	publish_error(ss, g_strdup_printf(
+			"Error! No TCP connection, retrying later."));
+	return;
+    }
+    ss->sessp = agent->tcp_sessp;
+    usm_join(ss);
+}
+
+/* The agent closed the connection, fail what was in flight on it */
+static void
+agent_disconnect(snmp_shard *shard, snmp_agent *agent)
+{
+    simple_session *ss;
+    snmp_request *request;
+    GSList *list, *req;
+
+    /* the reason, before closing times out what was in flight */
+    for (list = shard->sessions; list; list = list->next) {
+	ss = list->data;
+	if (ss->agent != agent || ss->transport != TRANSPORT_TCP)
+	    continue;
+	for (req = ss->requests; req; req = req->next) {
+	    request = req->data;
+	    if (!request->round->result.error)
+		request->round->result.error =
+			g_strdup_printf("Error! TCP connection lost.");
+	}
+    }
+    snmp_sess_close(agent->tcp_sessp);
+    agent->tcp_sessp = NULL;
+    agent->tcp_lost = FALSE;
+    agent_backoff(agent, clock_now());
+    for (list = agent->orphans; list; list = list->next)
+	request_done(list->data, 0);
+    g_slist_free_full(agent->orphans, g_free);
+    agent->orphans = NULL;
+
+    for (list = shard->sessions; list; list = list->next) {
+	ss = list->data;
+	if (ss->agent != agent || ss->transport != TRANSPORT_TCP)
+	    continue;
+	ss->sessp = NULL;
+	while (ss->requests) {
+	    request = ss->requests->data;
+	    ss->requests = g_slist_delete_link(ss->requests, ss->requests);
+	    if (!request->round->result.error)
+		request->round->result.error =
+			g_strdup_printf("Error! TCP connection lost.");
+	    request->round->pending--;
+	    request_done(request, 0);
+	    g_free(request);
+	}
+	publish_rounds(ss);
+    }
+}
+
+/*
+ * The poll scheduler, a binary min-heap on due per shard.
+ */
+
+static void
+sched_set(snmp_shard *shard, gint i, simple_session *ss)
+{
+    shard->heap[i] = ss;
+    ss->heap_index = i;
+}
+
+static void
+sched_up(snmp_shard *shard, gint i)
+{
+    simple_session *ss = shard->heap[i];
+    gint parent;
+
+    while (i > 0) {
+	parent = (i - 1) / 2;
+	if (shard->heap[parent]->due <= ss->due)
+	    break;
+	sched_set(shard, i, shard->heap[parent]);
+	i = parent;
+    }
+    sched_set(shard, i, ss);
+}
+
+static void
+sched_down(snmp_shard *shard, gint i)
+{
+    simple_session *ss = shard->heap[i];
+    gint child;
+
+    for (;;) {
+	child = 2 * i + 1;
+	if (child >= shard->heap_len)
+	    break;
+	if (child + 1 < shard->heap_len
+			&& shard->heap[child + 1]->due < shard->heap[child]->due)
+	    child++;
+	if (ss->due <= shard->heap[child]->due)
+	    break;
+	sched_set(shard, i, shard->heap[child]);
+	i = child;
+    }
+    sched_set(shard, i, ss);
+}
+
+static void
+sched_insert(snmp_shard *shard, simple_session *ss)
+{
+    if (shard->heap_len == shard->heap_size) {
+	shard->heap_size = shard->heap_size ? 2 * shard->heap_size : 16;
+	shard->heap = g_renew(simple_session *, shard->heap, shard->heap_size);
+    }
+    sched_set(shard, shard->heap_len++, ss);
+    sched_up(shard, ss->heap_index);
+}
+
+static void
+sched_remove(snmp_shard *shard, simple_session *ss)
+{
+    simple_session *last;
+    gint i = ss->heap_index;
+
+    if (i < 0)
+	return;
+    ss->heap_index = -1;
+    if (--shard->heap_len == i)
+	return;
+    last = shard->heap[shard->heap_len];
+    sched_set(shard, i, last);
+    sched_down(shard, i);
+    sched_up(shard, last->heap_index);
+}
+
+static void
+shard_open(simple_session *ss)
+{
+    struct snmp_session session;
+    gchar *error_msg = NULL;
+
+    if (ss->transport == TRANSPORT_TCP) {
+	agent_connect(ss);
+	return;
+    }
+
+    /* 
+     * Open an SNMP session.
+     */
+    session = ss->template;
+    session.callback_magic = ss->agent;
+    ss->sessp = open_session(ss, &session, &error_msg);
+    if (ss->sessp == NULL)
+	publish_error(ss, error_msg);
+}
+
+static gboolean
+send_request(simple_session *ss, snmp_round *round, gint *var, gint num_var)
+{
+    struct snmp_pdu *pdu;
+    snmp_request *request;
+    gint i;
+
+    /* 
+     * Create PDU for GET request and add the object names.
+     */
+    pdu = snmp_pdu_create(SNMP_MSG_GET);
+    for (i = 0; i < num_var; i++) {
+	if (var[i] == VAR_UPTIME)
+	    snmp_add_null_var(pdu, sysUpTime, OID_LENGTH(sysUpTime));
+	else if (var[i] >= VAR_DISC)
+	    snmp_add_null_var(pdu, ss->disc_name[var[i] - VAR_DISC],
+							DISC_OID_LEN);
+	else
+	    snmp_add_null_var(pdu, ss->name[var[i]], ss->name_length[var[i]]);
+    }
+    /* the sessions sharing a TCP connection may differ in these */
+    pdu->version = ss->template.version;
+    if (pdu->version == SNMP_VERSION_3) {
+	pdu->securityModel = ss->template.securityModel;
+	pdu->securityLevel = ss->template.securityLevel;
+	pdu->securityName = strdup(ss->template.securityName);
+	pdu->securityNameLen = ss->template.securityNameLen;
+    } else {
+	pdu->community = (u_char *)strdup((char *)ss->template.community);
+	pdu->community_len = ss->template.community_len;
+    }
+
+    /* 
+     * Perform the request, remember when for the round trip time.
+     */
+    request = g_new0(snmp_request, 1);
+    request->ss = ss;
+    request->agent = ss->agent;
+    request->round = round;
+    request->num_var = num_var;
+    memcpy(request->var, var, num_var * sizeof(gint));
+    request->sent = clock_now();
+    if (ss->template.version == SNMP_VERSION_3)
+	g_rec_mutex_lock(&usm_lock);
+    request->reqid = snmp_sess_async_send(ss->sessp, pdu, snmp_input, request);
+    if (ss->template.version == SNMP_VERSION_3)
+	g_rec_mutex_unlock(&usm_lock);
+    if (!request->reqid) {
+	snmp_free_pdu(pdu);
+	g_free(request);
+	return FALSE;
+    }
+    /* the other sessions polling these may wait for them */
+    for (i = 0; i < num_var; i++) {
+	if (var[i] >= VAR_DISC || !ss->sub[var[i]])
+	    continue;
+	request->sub[i] = ss->sub[var[i]];
+	request->sub[i]->fetching++;
+	request->sub[i]->fetcher = ss;
+    }
+    /* retries after an error are paid for too, the bucket may go short */
+    agent_refill(ss->agent, request->sent);
+    if (ss->agent->rate > 0)
+	ss->agent->tokens--;
+    capture_pdu(capture, CAPTURE_REQUEST, ss->id, request->reqid,
+						request->sent, pdu);
+    ss->requests = g_slist_prepend(ss->requests, request);
+    round->pending++;
+    return TRUE;
+}
+
+/*
+ * Send the poll that is due.  An OID another session of the agent fetched
+ * within the interval is taken from it, one it is fetching right now is
+ * waited for, only the rest goes out.  If the agent's rate limit doesn't
+ * allow for its PDUs yet, the poll is held back with its OIDs still due,
+ * and this returns when to try again.  Else 0.
+ */
+static gint64
+shard_send(simple_session *ss)
+{
+    gint var[MAX_REQUEST_VAR];
+    gint recheck[MAX_OID_STR];
+    gint num_var = 0, num_recheck = 0;
+    snmp_agent *agent = ss->agent;
+    snmp_round *round;
+    snmp_waiter *waiter;
+    snmp_sub *sub;
+    guint sent = 0, shared = 0, joined = 0;
+    gboolean uptime;
+    gdouble need;
+    gint64 now;
+    gint i, n;
+
+    /* a failed open is retried with every poll */
+    if (ss->sessp == NULL)
+	shard_open(ss);
+    if (ss->sessp == NULL)
+	return 0;
+
+    /*
+     * The agent is slower than the interval, skip this poll.  Over long
+     * round trips, pipelining keeps more than one poll in flight.
+     */
+    if (ss->num_rounds >= g_atomic_int_get(&pipeline))
+	return 0;
+
+    /* the object names due, rechecks of failed ones aside */
+    now = clock_now();
+    for (i = 0; i < ss->num_oid; i++) {
+	if (ss->wait[i] > 0)
+	    continue;
+	if (ss->quarantine & (1 << i)) {
+	    recheck[num_recheck++] = i;
+	    continue;
+	}
+	sub = ss->sub[i];
+	if (sub && sub->time > ss->seen[i] && now - sub->time < ss->interval) {
+	    shared |= 1 << i;
+	    continue;
+	}
+	if (sub && sub->fetching > 0 && sub->fetcher != ss) {
+	    joined |= 1 << i;
+	    continue;
+	}
+	var[num_var++] = i;
+	sent |= 1 << i;
+    }
+    if (!sent && !shared && !joined && !num_recheck) {
+	/* nothing due this time */
+	count_down(ss);
+	return 0;
+    }
+    for (i = 0; i < ss->num_disc; i++) {
+	/* only for the counters that are fetched anyway */
+	if ((ss->disc_missing & (1 << i)) || !(ss->disc_for[i] & sent))
+	    continue;
+	var[num_var++] = VAR_DISC + i;
+    }
+
+    /* sysUpTime, unless another session fetched it within the interval */
+    uptime = ss->interval == 0 || now - agent->uptime_sent >= ss->interval;
+    if (uptime)
+	var[num_var++] = VAR_UPTIME;
+
+    /*
+     * One token per PDU.  A poll needing more than the bucket holds goes
+     * out once it is full, and leaves it short for the following ones.
+     */
+    n = agent->max_var ? agent->max_var : MAX(num_var, 1);
+    need = (n ? (num_var + n - 1) / n : 0) + num_recheck;
+    agent_refill(agent, now);
+    if (agent->rate > 0 && agent->tokens < MIN(need, RATE_BURST(agent->rate))) {
+	if (!ss->held)
+	    ss->deferred++;
+	ss->held = TRUE;
+	return now + 1 + (MIN(need, RATE_BURST(agent->rate)) - agent->tokens)
+					/ agent->rate * G_USEC_PER_SEC;
+    }
+    count_down(ss);
+    if (uptime)
+	agent->uptime_sent = now;
+
+    round = g_new0(snmp_round, 1);
+    round->result.ss = ss;
+    round->result.set.deferred = ss->deferred;
+    ss->deferred = 0;
+    ss->held = FALSE;
+    if (ss->rebase) {
+	/* a counter may have wrapped unseen while paused */
+	round->result.set.discontinuity = (1 << ss->num_oid) - 1;
+	ss->rebase = FALSE;
+    }
+    ss->rounds = g_slist_append(ss->rounds, round);
+    ss->num_rounds++;
+
+    for (i = 0; i < ss->num_oid; i++) {
+	if (shared & (1 << i)) {
+	    share_value(ss, round, i, ss->sub[i]);
+	} else if (joined & (1 << i)) {
+	    waiter = g_new0(snmp_waiter, 1);
+	    waiter->ss = ss;
+	    waiter->round = round;
+	    waiter->k = i;
+	    ss->sub[i]->waiters = g_slist_prepend(ss->sub[i]->waiters, waiter);
+	    round->pending++;
+	}
+    }
+
+    /* as many varbinds per request as the agent is known to handle */
+    for (i = 0; i < num_var; i += n) {
+	if (!send_request(ss, round, var + i, MIN(n, num_var - i))) {
+	    round->result.error =
+			g_strdup_printf("snmp_send() returned error\n");
+	    break;
+	}
+    }
+    /* a recheck failing again must not fail the others */
+    for (i = 0; i < num_recheck && !round->result.error; i++) {
+	if (!send_request(ss, round, recheck + i, 1))
+	    round->result.error =
+			g_strdup_printf("snmp_send() returned error\n");
+    }
+    publish_rounds(ss);
+    return 0;
+}
+
+static gint64
+shard_run_due(snmp_shard *shard, gint64 now)
+{
+    simple_session *ss;
+    gint64 retry;
+
+    while (shard->heap_len > 0 && shard->heap[0]->due <= now) {
+	ss = shard->heap[0];
+	retry = shard_send(ss);
+	if (retry) {
+	    /* held back by the rate limit, it goes out as soon as allowed */
+	    ss->due = retry;
+	    sched_down(shard, 0);
+	} else if (ss->interval > 0) {
+	    /* keep the phase, unless we fell behind by a whole interval */
+	    ss->due += ss->interval;
+	    if (ss->due <= now)
+		ss->due = now + ss->interval;
+	    sched_down(shard, 0);
+	} else {
+	    sched_remove(shard, ss);
+	}
+    }
+
+    return shard->heap_len > 0 ? shard->heap[0]->due : -1;
+}
+
+static void
+find_discontinuity_oids(simple_session *ss)
+{
+    oid *name;
+    size_t len;
+    oid if_index;
+    gint i, k;
+
+    ss->num_disc = 0;
+    ss->disc_missing = 0;
+    /* v1 would fail the whole request, if the agent lacks the IF-MIB */
+    if (ss->template.version == SNMP_VERSION_1)
+	return;
+
+    for (i = 0; i < ss->num_oid; i++) {
+	name = ss->name[i];
+	len = ss->name_length[i];
+	/* <entry>.<column>.<ifIndex> */
+	if (!(len == OID_LENGTH(ifEntry) + 2
+		    && !memcmp(name, ifEntry, sizeof(ifEntry)))
+		&& !(len == OID_LENGTH(ifXEntry) + 2
+		    && !memcmp(name, ifXEntry, sizeof(ifXEntry))))
+	    continue;
+	if_index = name[len - 1];
+
+	for (k = 0; k < ss->num_disc; k++) {
+	    if (ss->disc_name[k][DISC_OID_LEN - 1] == if_index)
+		break;
+	}
+	if (k == ss->num_disc) {
+	    memcpy(ss->disc_name[k], ifXEntry, sizeof(ifXEntry));
+	    ss->disc_name[k][DISC_OID_LEN - 2] = IF_COUNTER_DISCONTINUITY_TIME;
+	    ss->disc_name[k][DISC_OID_LEN - 1] = if_index;
+	    ss->disc_for[k] = 0;
+	    ss->disc_value[k] = -1;
+	    ss->disc_time[k] = 0;
+	    ss->num_disc++;
+	}
+	ss->disc_for[k] |= 1 << i;
+    }
+}
+
+static void
+shard_poll(snmp_shard *shard, snmp_command *command)
+{
+    simple_session *ss = command->ss;
+    gint i;
+
+    /* the command's OIDs now belong to the session */
+    for (i = 0; i < ss->num_oid; i++) {
+	sub_drop(ss, i, TRUE);
+	g_free(ss->name[i]);
+    }
+    for (i = 0; i < command->num_oid; i++) {
+	ss->name[i] = command->name[i];
+	ss->name_length[i] = command->name_length[i];
+	ss->refresh[i] = command->refresh[i];
+	ss->wait[i] = 0;
+	ss->sub[i] = sub_get(ss, i);
+	ss->seen[i] = 0;
+	ss->resets[i] = ss->sub[i]->resets;
+    }
+    ss->num_oid = command->num_oid;
+    command->num_oid = 0;
+    ss->quarantine = 0;
+    free_cache(ss);
+    find_discontinuity_oids(ss);
+
+    ss->interval = command->interval;
+    ss->due = clock_now();
+    ss->paused = FALSE;
+    if (ss->heap_index < 0) {
+	sched_insert(shard, ss);
+    } else {
+	sched_up(shard, ss->heap_index);
+    }
+    /* the rounds that waited for the old OIDs only */
+    publish_rounds(ss);
+}
+
+/*
+ * Slow down, pause or resume the polls of a session.  A shorter interval
+ * takes effect at once, a longer one with the next poll.
+ */
+static void
+shard_interval(snmp_shard *shard, simple_session *ss, gint64 interval)
+{
+    gint64 now = clock_now();
+
+    if (ss->interval == 0 && !ss->paused)
+	/* a single request, or not polling yet */
+	return;
+
+    if (interval < 0) {
+	ss->paused = TRUE;
+	sched_remove(shard, ss);
+	return;
+    }
+
+    if (ss->paused) {
+	ss->paused = FALSE;
+	ss->rebase = TRUE;
+	invalidate(ss, ~0);
+	ss->interval = interval;
+	ss->due = now;
+	sched_insert(shard, ss);
+	return;
+    }
+
+    if (interval < ss->interval) {
+	ss->due = now;
+	ss->interval = interval;
+	sched_up(shard, ss->heap_index);
+    } else {
+	ss->due += interval - ss->interval;
+	ss->interval = interval;
+	sched_down(shard, ss->heap_index);
+    }
+}
+
+static void
+shard_close(snmp_shard *shard, simple_session *ss)
+{
+    snmp_result result;
+    snmp_request *request;
+    GSList *list;
+    gint i;
+
+    sched_remove(shard, ss);
+    for (i = 0; i < ss->num_oid; i++)
+	sub_drop(ss, i, FALSE);
+    if (ss->transport == TRANSPORT_TCP) {
+	/* the connection stays, the answers to ss are dropped */
+	for (list = ss->requests; list; list = list->next) {
+	    request = list->data;
+	    request->ss = NULL;
+	    request->round = NULL;
+	}
+	ss->agent->orphans = g_slist_concat(ss->agent->orphans, ss->requests);
+	ss->requests = NULL;
+    } else if (ss->sessp) {
+	snmp_sess_close(ss->sessp);
+    }
+    ss->sessp = NULL;
+    for (list = ss->requests; list; list = list->next)
+	request_done(list->data, 0);
+    g_slist_free_full(ss->requests, g_free);
+    ss->requests = NULL;
+    g_slist_free_full(ss->rounds, (GDestroyNotify)free_round);
+    ss->rounds = NULL;
+    ss->num_rounds = 0;
+    free_cache(ss);
+    agent_put(shard, ss->agent);
+    ss->agent = NULL;
+    shard->sessions = g_slist_remove(shard->sessions, ss);
+
+    /* The GTK thread frees ss, after it has seen all earlier results */
+    memset(&result, 0, sizeof(result));
+    result.ss = ss;
+    result.release = 1;
+    if (!ring_push(&shard->results, &result))
+	shard->releasing = g_slist_append(shard->releasing, ss);
+}
+
+static void
+free_command(snmp_command *command)
+{
+    gint i;
+
+    for (i = 0; i < command->num_oid; i++)
+	g_free(command->name[i]);
+    g_free(command);
+}
+
+static void
+shard_commands(snmp_shard *shard)
+{
+    snmp_command *command;
+    snmp_result result;
+    gchar buf[64];
+
+    /* drain the wakeup pipe, the queue is what counts */
+    while (read(shard->wakeup[0], buf, sizeof(buf)) > 0)
+	/*EMPTY*/ ;
+
+    /* retry releases that didn't fit into the ring */
+    while (shard->releasing) {
+	memset(&result, 0, sizeof(result));
+	result.ss = shard->releasing->data;
+	result.release = 1;
+	if (!ring_push(&shard->results, &result))
+	    break;
+	shard->releasing = g_slist_delete_link(shard->releasing,
+							shard->releasing);
+    }
+
+    while ((command = g_async_queue_try_pop(shard->commands)) != NULL) {
+	switch (command->cmd) {
+	case CMD_OPEN:
+	    shard->sessions = g_slist_append(shard->sessions, command->ss);
+	    command->ss->agent = agent_get(shard, command->ss);
+	    command->ss->boots = command->ss->agent->boots;
+	    shard_open(command->ss);
+	    break;
+	case CMD_POLL:
+	    shard_poll(shard, command);
+	    break;
+	case CMD_INTERVAL:
+	    shard_interval(shard, command->ss, command->interval);
+	    break;
+	case CMD_CLOSE:
+	    shard_close(shard, command->ss);
+	    break;
+	}
+	free_command(command);
+    }
+}
+
+/* Whether the shard has a v3 session, which decodes through the USM */
+static gboolean
+shard_usm(snmp_shard *shard)
+{
+    GSList *list;
+
+    for (list = shard->sessions; list; list = list->next)
+	if (((simple_session *)list->data)->template.version
+							== SNMP_VERSION_3)
+	    return TRUE;
+    return FALSE;
+}
+
+/*
+ * One turn of a shard: commands, due polls, then whatever the sessions
+ * have received or timed out on.  Waits for that unless stepped, returns
+ * when the shard next has work to do.
+ */
+static gint64
+shard_turn(snmp_shard *shard, gboolean wait)
+{
+    GSList *list;
+    GHashTableIter iter;
+    simple_session *ss;
+    snmp_agent *agent;
+    gboolean usm;
+    gint count;
+    gint numfds, block;
+    gint64 now, due;
+    netsnmp_large_fd_set fdset;
+    struct timeval timeout, sess_timeout;
+
+    shard_commands(shard);
+    now = clock_now();
+    due = shard_run_due(shard, now);
+
+    /*
+     * Every UDP session has a socket of its own, thousands of readers are
+     * past FD_SETSIZE.  The library's large fd sets grow as needed.
+     */
+    numfds = shard->wakeup[0] + 1;
+    netsnmp_large_fd_set_init(&fdset, FD_SETSIZE);
+    NETSNMP_LARGE_FD_SET(shard->wakeup[0], &fdset);
+    /* wake up regularly to retry pending releases */
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    if (due >= 0 && due - now < G_USEC_PER_SEC) {
+	timeout.tv_sec = 0;
+	timeout.tv_usec = due - now;
+    }
+    for (list = shard->sessions; list; list = list->next) {
+	ss = list->data;
+	if (!ss->sessp || ss->transport == TRANSPORT_TCP)
+	    continue;
+	block = 1;
+	snmp_sess_select_info2(ss->sessp, &numfds, &fdset,
+					    &sess_timeout, &block);
+	if (!block && timercmp(&sess_timeout, &timeout, <))
+	    timeout = sess_timeout;
+    }
+    g_hash_table_iter_init(&iter, shard->agents);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&agent)) {
+	if (!agent->tcp_sessp)
+	    continue;
+	block = 1;
+	snmp_sess_select_info2(agent->tcp_sessp, &numfds, &fdset,
+					    &sess_timeout, &block);
+	if (!block && timercmp(&sess_timeout, &timeout, <))
+	    timeout = sess_timeout;
+    }
+
+    due = now + timeout.tv_sec * G_USEC_PER_SEC + timeout.tv_usec;
+    if (!wait)
+	timerclear(&timeout);
+    count = netsnmp_large_fd_set_select(numfds, &fdset, NULL, NULL, &timeout);
+    if (count < 0) {
+	if (errno != EINTR)
+	    fprintf(stderr, "snmp error on select\n");
+	netsnmp_large_fd_set_cleanup(&fdset);
+	return due;
+    }
+    /* the other shards may be decoding v3 too */
+    usm = shard_usm(shard);
+    if (usm)
+	g_rec_mutex_lock(&usm_lock);
+    for (list = shard->sessions; list; list = list->next) {
+	ss = list->data;
+	if (!ss->sessp || ss->transport == TRANSPORT_TCP)
+	    continue;
+	if (count > 0)
+	    snmp_sess_read2(ss->sessp, &fdset);
+	snmp_sess_timeout(ss->sessp);
+    }
+    g_hash_table_iter_init(&iter, shard->agents);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&agent)) {
+	if (!agent->tcp_sessp)
+	    continue;
+	if (count > 0)
+	    snmp_sess_read2(agent->tcp_sessp, &fdset);
+	if (!agent->tcp_lost)
+	    snmp_sess_timeout(agent->tcp_sessp);
+	if (agent->tcp_lost)
+	    agent_disconnect(shard, agent);
+    }
+    if (usm)
+	g_rec_mutex_unlock(&usm_lock);
+    netsnmp_large_fd_set_cleanup(&fdset);
+
+    return due;
+}
+
+static gpointer
+shard_main(gpointer data)
+{
+    snmp_shard *shard = data;
+
+    for (;;)
+	shard_turn(shard, TRUE);
+
+    return NULL;
+}
+
+static void
+shard_post(snmp_shard *shard, snmp_command *command)
+{
+    g_async_queue_push(shard->commands, command);
+    if (write(shard->wakeup[1], "", 1) < 0 && errno != EAGAIN)
+	fprintf(stderr, "snmp shard wakeup failed\n");
+}
+
+static snmp_shard *
+shard_start()
+{
+    snmp_shard *shard;
+
+    shard = g_new0(snmp_shard, 1);
+    if (pipe(shard->wakeup) < 0) {
+	fprintf(stderr, "snmp shard pipe failed\n");
+	g_free(shard);
+	return NULL;
+    }
+    fcntl(shard->wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(shard->wakeup[1], F_SETFL, O_NONBLOCK);
+    shard->commands = g_async_queue_new();
+    shard->agents = g_hash_table_new(g_str_hash, g_str_equal);
+    if (!stepped)
+	shard->thread = g_thread_new("snmp", shard_main, shard);
+    return shard;
+}
+
+typedef struct {
+	snmp_shard		*shard;
+	gint			sessions;	/* open ones */
+} placement;
+
+static snmp_shard *
+shard_for(simple_session *ss, gchar *peername, gint port)
+{
+    placement *place;
+
+    /*
+     * All sessions to one agent end up in the same shard, also when the
+     * number of shards changed since the first of them was opened.
+     */
+    ss->placed = g_strdup_printf("%s:%d", agent_peername(peername), port);
+    if (!placements)
+	placements = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, g_free);
+    place = g_hash_table_lookup(placements, ss->placed);
+    if (!place) {
+	place = g_new0(placement, 1);
+	place->shard = shards[g_str_hash(ss->placed) % use_shards];
+	g_hash_table_insert(placements, g_strdup(ss->placed), place);
+    }
+    place->sessions++;
+    return place->shard;
+}
+
+/* The agent may go to another shard once its last session is closed */
+static void
+shard_unplace(simple_session *ss)
+{
+    placement *place;
+
+    place = g_hash_table_lookup(placements, ss->placed);
+    if (place && --place->sessions == 0)
+	g_hash_table_remove(placements, ss->placed);
+    g_free(ss->placed);
+    ss->placed = NULL;
+}
+
+/*
+ * The interface functions, called from the GTK thread.
+ */
+
+void
+simpleSNMPinit()
+{
+
+#ifdef DEBUG_SNMP
+    debug_register_tokens("all");
+    snmp_set_do_debugging(1);
+#endif /* DEBUG_SNMP */
+
+    /* the MIBs, and the security modules for v3 */
+    init_snmp("gkrellm_snmp");
+    usm_engines = g_hash_table_new(g_str_hash, g_str_equal);
+    usm_passphrases = g_hash_table_new(g_str_hash, g_str_equal);
+
+    simpleSNMPset_threads(1);
+}
+
+void
+simpleSNMPset_threads(gint num_threads)
+{
+    snmp_shard *shard;
+
+    num_threads = CLAMP(num_threads, 1, MAX_SHARDS);
+    while (num_shards < num_threads) {
+	shard = shard_start();
+	if (!shard)
+	    break;
+	shards[num_shards++] = shard;
+    }
+    /*
+     * Shards are never stopped, sessions stay where they are and
+     * only new agents are spread over the new number of shards.
+     */
+    if (num_shards > 0)
+	use_shards = MIN(num_threads, num_shards);
+}
+
+/*
+ * Polls a session may have in flight.  Results are still delivered in
+ * the order the polls were sent.
+ */
+void
+simpleSNMPset_pipeline(gint depth)
+{
+    g_atomic_int_set(&pipeline, CLAMP(depth, 1, MAX_PIPELINE));
+}
+
+/*
+ * Limit the PDUs per second sent to an agent, 0 for no limit.  A NULL
+ * peername sets the limit of all agents without one of their own, a
+ * negative rate drops an agent's own limit.  Polls over the limit are
+ * held back, with the OIDs due, until the agent's bucket allows them.
+ */
+void
+simpleSNMPset_rate(const gchar *peername, gint port, gdouble rate)
+{
+    gchar *key;
+    gdouble *limit;
+
+    key = peername ? g_strdup_printf("%s:%d",
+				agent_peername((gchar *)peername), port)
+		   : g_strdup("");
+    g_mutex_lock(&rate_lock);
+    if (!rate_limits)
+	rate_limits = g_hash_table_new_full(g_str_hash, g_str_equal,
+					    g_free, g_free);
+    if (rate < 0 && peername) {
+	g_hash_table_remove(rate_limits, key);
+	g_free(key);
+    } else {
+	limit = g_new(gdouble, 1);
+	*limit = MAX(rate, 0);
+	g_hash_table_replace(rate_limits, key, limit);
+    }
+    g_mutex_unlock(&rate_lock);
+    g_atomic_int_inc(&rate_serial);
+}
+
+/*
+ * Run the engine on another clock (monotonic usec) and without worker
+ * threads, for simulations: the caller turns the shards with
+ * simpleSNMPstep().  Must come before simpleSNMPinit().
+ */
+void
+simpleSNMPsimulate(gint64 (*now)(void))
+{
+    clock_now = now;
+    stepped = TRUE;
+}
+
+/*
+ * Give each shard one turn, without waiting.  Returns the earliest time
+ * a shard has work again, i.e. until the clock may be advanced.
+ */
+gint64
+simpleSNMPstep()
+{
+    gint64 due, next = G_MAXINT64;
+    gint n;
+
+    for (n = 0; n < num_shards; n++) {
+	due = shard_turn(shards[n], FALSE);
+	next = MIN(next, due);
+    }
+    return next;
+}
+
+/*
+ * Record the traffic of all sessions opened from now on to a file,
+ * see capture.h.
+ */
+void
+simpleSNMPrecord(const gchar *path)
+{
+    if (!capture)
+	capture = capture_create(path);
+}
+
+/*
+ * Hand the finished polls to their readers.  Returns the number of values
+ * fetched from the agents for them, not counting shared ones twice.
+ */
+gint
+simpleSNMPupdate()
+{
+    snmp_result result;
+    input_data *new_data;
+    gint num_values = 0;
+    gint n;
+
+    for (n = 0; n < num_shards; n++)
+    while (ring_pop(&shards[n]->results, &result)) {
+	if (result.release) {
+	    g_free(result.ss->template.peername);
+	    free_security(&result.ss->template, result.ss->auth_pass,
+						result.ss->priv_pass);
+	    g_free(result.ss);
+	    continue;
+	}
+	new_data = result.ss->data;
+	if (!new_data) {
+	    /* the session was closed meanwhile */
+	    free_result(&result);
+	    continue;
+	}
+	if (result.error) {
+	    if (new_data->error) g_free(new_data->error);
+	    new_data->error = result.error;
+	} else {
+	    /* an unread poll in the back set is superseded, not its news */
+	    result.set.reboot |= INPUT_BACK(new_data)->reboot;
+	    result.set.discontinuity |= INPUT_BACK(new_data)->discontinuity;
+	    result.set.deferred += INPUT_BACK(new_data)->deferred;
+	    free_set(INPUT_BACK(new_data));
+	    *INPUT_BACK(new_data) = result.set;
+	    num_values += __builtin_popcount(result.set.fresh
+					     & ~result.set.shared);
+	}
+	/* Mark that there is new data */
+	new_data->new = 1;
+    }
+
+    return num_values;
+}
+
+/*
+ * Make the latest poll the reader's set.  The set it had becomes the back
+ * set, its strings are freed when the next poll is moved in.
+ */
+void
+simpleSNMPswap(input_data *data)
+{
+    data->front = !data->front;
+    data->new = 0;
+    /* read, they mustn't be carried into the next poll */
+    INPUT_BACK(data)->reboot = FALSE;
+    INPUT_BACK(data)->discontinuity = 0;
+    INPUT_BACK(data)->deferred = 0;
+}
+
+void
+simpleSNMPfree_data(input_data *data)
+{
+    free_set(&data->set[0]);
+    free_set(&data->set[1]);
+    g_free(data->error);
+    data->error = NULL;
+}
+
+simple_session *
+simpleSNMPopen(gchar *peername,
+	       gint port,
+	       gint vers,
+	       gchar *community,
+	       gint transport,
+	       input_data *data)
+{
+    simple_session *ss;
+    snmp_command *command;
+
+    ss = g_new0(simple_session, 1);
+    ss->id = ++num_opened;
+    ss->shard = shard_for(ss, peername, port);
+    ss->heap_index = -1;
+    ss->data = data;
+    /* a peer name of "tcp:host" still means TCP */
+    if (g_str_has_prefix(peername, "tcp:"))
+	transport = TRANSPORT_TCP;
+    ss->transport = transport;
+
+    /*
+     * initialize session to default values,
+     * the shard opens it asynchronously
+     */
+    snmp_sess_init( &ss->template );
+
+    session_security(&ss->template, vers, community,
+		     &ss->auth_pass, &ss->priv_pass);
+    ss->template.peername = transport_peername(peername, transport);
+    ss->template.remote_port = port;
+
+    ss->template.retries = SNMP_DEFAULT_RETRIES;
+    ss->template.timeout = SNMP_DEFAULT_TIMEOUT;
+
+    /* the requests have their own callbacks, see send_request() */
+    ss->template.callback = agent_input;
+    ss->template.authenticator = NULL;
+
+    command = g_new0(snmp_command, 1);
+    command->cmd = CMD_OPEN;
+    command->ss = ss;
+    shard_post(ss->shard, command);
+
+    return ss;
+}
+
+gint
+simpleSNMPpoll(simple_session *session, gchar **oid_str, gint *refresh,
+	       gint num_oid_str, gint64 interval)
+{
+    snmp_command *command;
+    oid name[MAX_OID_LEN];
+    size_t name_length;
+    gchar *error = NULL;
+    input_data *new_data = NULL;
+    gint i;
+
+    command = g_new0(snmp_command, 1);
+    command->cmd = CMD_POLL;
+    command->ss = session;
+    command->interval = interval;
+
+    /* Prepare the objid's, the MIB is only used from this thread */
+    for (i = 0; i < num_oid_str && i < MAX_OID_STR; i++) {
+	name_length = MAX_OID_LEN;
+	if (!snmp_parse_oid(oid_str[i], name, &name_length)) {
+	    error = g_strdup_printf("error parsing oid: %s", oid_str[i]);
+	    break;
+	}
+	command->name[i] = g_memdup2(name, name_length * sizeof(oid));
+	command->name_length[i] = name_length;
+	/* without refresh classes every OID is fetched with every poll */
+	command->refresh[i] = refresh ? refresh[i] : 1;
+	command->num_oid = i + 1;
+    }
+
+    if (error) {
+	free_command(command);
+	new_data = session->data;
+	if (new_data) {
+	    if (new_data->error) g_free (new_data->error);
+	    new_data->error = error;
+	    new_data->new = 1;
+	} else {
+	    g_free(error);
+	}
+    } else {
+	capture_session(capture, session->id, &session->template,
+			oid_str, refresh, command->num_oid, interval);
+	shard_post(session->shard, command);
+    }
+
+    return (!error);
+}
+
+void
+simpleSNMPset_interval(simple_session *session, gint64 interval)
+{
+    snmp_command *command;
+
+    command = g_new0(snmp_command, 1);
+    command->cmd = CMD_INTERVAL;
+    command->ss = session;
+    command->interval = interval;
+    shard_post(session->shard, command);
+}
+
+void 
+simpleSNMPclose(simple_session *session)
+{
+    snmp_command *command;
+
+    /* the shard releases the handle once it's done with it */
+    session->data = NULL;
+    shard_unplace(session);
 
-    snmp_close(session);
+    command = g_new0(snmp_command, 1);
+    command->cmd = CMD_CLOSE;
+    command->ss = session;
+    shard_post(session->shard, command);
 }
 
 gint
@@ -33,32 +33,122 @@
 
 #include <glib.h>
 
+/* g_memdup() truncates to guint and is deprecated since GLib 2.68 */
+#if !GLIB_CHECK_VERSION(2, 68, 0)
+#define g_memdup2(mem, byte_size) g_memdup(mem, byte_size)
+#endif
 
 /* The data structure for a chart */
 
 #define MAX_OID_STR 10
 
-typedef struct input_data input_data;
+/* What a numeric sample is, in order to compute deltas */
 
-struct input_data {
+enum {
+    SAMPLE_GAUGE,	/* may go up and down */
+    SAMPLE_COUNTER32,	/* wraps at 2^32 */
+    SAMPLE_COUNTER64,	/* never wraps, going backwards is a reset */
+    SAMPLE_TIMETICKS	/* going backwards is a reset */
+};
+
+/*
+ * One poll's samples.  The strings are owned by the set and go with it.
+ */
+
+typedef struct sample_set sample_set;
+
+struct sample_set {
 	gint			asn1_type[MAX_OID_STR];
 	gchar			*sample[MAX_OID_STR];
-	u_long			sample_n[MAX_OID_STR];
+	gint64			sample_n[MAX_OID_STR];
+	gint			kind[MAX_OID_STR];
 	gint			num_sample;
+	/* bit i set: the agent reported a counter reset for sample i,
+	   or the polls were paused and its delta starts over */
+	guint			discontinuity;
+	/* bit i set: sample i was fetched now, else it is a cached value */
+	guint			fresh;
+	/* bit i set: fresh sample i was fetched by another session */
+	guint			shared;
+	/* bit i set: the agent has no value for sample i, it is rechecked */
+	guint			missing;
+	/* the agent's sysUpTime (TimeTicks) at timestamp, -1 if unknown */
+	gint64			uptime;
+	/* set if the agent restarted since the last sample */
+	gboolean		reboot;
+	/* local monotonic usec when the agent sampled, i.e. receive - rtt/2 */
+	gint64			timestamp;
+	/* when sample i was sampled, of another session's poll if shared */
+	gint64			sample_time[MAX_OID_STR];
+	gint64			rtt;
+	/* polls held back by the agent's rate limit since the one before */
+	guint			deferred;
+};
+
+/*
+ * simpleSNMPupdate() moves a finished poll into the back set, then the
+ * reader flips to it with simpleSNMPswap().  No sample is copied on the way.
+ */
+
+typedef struct input_data input_data;
+
+struct input_data {
+	sample_set		set[2];
+	/* the index of the reader's set */
+	gint			front;
 	gchar			*error;
 	/* new is set to 1 after input_data has been updated */
 	gint			new;
 };
 
+#define INPUT_FRONT(data)	(&(data)->set[(data)->front])
+#define INPUT_BACK(data)	(&(data)->set[!(data)->front])
+
+/*
+ * How often an OID is fetched, in polls.  Static OIDs are fetched once and
+ * then cached, until the agent reboots or reports a counter discontinuity.
+ */
+#define REFRESH_STATIC	0
+
+/* An interval for simpleSNMPset_interval(), to stop polling until resumed */
+#define PAUSE_INTERVAL	(-1)
+
+/* The most polls in flight per session */
+#define MAX_PIPELINE	16
+
+/* How to reach an agent.  Sessions over TCP share one connection per agent */
+
+enum {
+    TRANSPORT_UDP,
+    TRANSPORT_TCP
+};
+
+/* The handle for a session owned by one of the SNMP worker threads */
+
+typedef struct simple_session simple_session;
+
 /* The interface functions for SNMP */
 
 extern	void simpleSNMPinit();
-extern	gchar *simpleSNMPprobe(gchar *peer, gint port, gint vers, gchar *community);
-extern	struct snmp_session *simpleSNMPopen(gchar *peername, gint port, gint vers,
-					gchar *community, void *data);
-extern	void simpleSNMPupdate();
-extern	gint simpleSNMPsend(struct snmp_session *session, 
-					gchar **oid_str, gint num_oid_str);
-extern	void simpleSNMPclose(struct snmp_session *session);
+extern	void simpleSNMPset_threads(gint num_threads);
+extern	void simpleSNMPset_pipeline(gint depth);
+extern	void simpleSNMPset_rate(const gchar *peername, gint port,
+					gdouble rate);
+extern	void simpleSNMPrecord(const gchar *path);
+extern	void simpleSNMPsimulate(gint64 (*now)(void));
+extern	gint64 simpleSNMPstep();
+extern	gchar *simpleSNMPprobe(gchar *peer, gint port, gint vers,
+					gchar *community, gint transport);
+extern	simple_session *simpleSNMPopen(gchar *peername, gint port, gint vers,
+					gchar *community, gint transport,
+					input_data *data);
+extern	gint simpleSNMPupdate();
+extern	void simpleSNMPswap(input_data *data);
+extern	void simpleSNMPfree_data(input_data *data);
+extern	gint simpleSNMPpoll(simple_session *session, gchar **oid_str,
+					gint *refresh, gint num_oid_str,
+					gint64 interval);
+extern	void simpleSNMPset_interval(simple_session *session, gint64 interval);
+extern	void simpleSNMPclose(simple_session *session);
 extern	gint simpleSNMPcheck_oid(const char *argv);
 